@@ -9,8 +9,14 @@ fi
 
 egrep "\?\?\?" *.c *.h
 
-gcc -Wall -g -O3 -DCACHE_LINE_SIZE=$CACHE_LINE_SIZE -o lgr_test $OPTS lgr_hook.c q.c cprt.c lgr_test.c
+gcc -Wall -g -O3 -DCACHE_LINE_SIZE=$CACHE_LINE_SIZE -o lgr_test $OPTS lgr_hook.c lgr_fmt.c lgr_uring.c q.c qm.c cprt.c lgr_test.c
 if [ $? -ne 0 ]; then exit 1; fi
 
-gcc -Wall -g -O3 -DCACHE_LINE_SIZE=$CACHE_LINE_SIZE -o lgr_perf $OPTS lgr.c q.c cprt.c lgr_perf.c
+gcc -Wall -g -O3 -DCACHE_LINE_SIZE=$CACHE_LINE_SIZE -o lgr_bench $OPTS lgr.c lgr_fmt.c lgr_uring.c q.c qm.c cprt.c lgr_bench.c
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -g -O3 -DCACHE_LINE_SIZE=$CACHE_LINE_SIZE -o lgr_decode $OPTS lgr.c lgr_fmt.c lgr_uring.c q.c qm.c cprt.c lgr_decode.c
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -g -O3 -DCACHE_LINE_SIZE=$CACHE_LINE_SIZE -o q_bench $OPTS q.c cprt.c q_bench.c
 if [ $? -ne 0 ]; then exit 1; fi
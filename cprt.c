@@ -24,6 +24,18 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
+#if CPRT_HAVE_TSC && ! defined(_WIN32)
+  #include <cpuid.h>
+#endif
+
+#if defined(_WIN32)
+  #pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+  #include <sys/syscall.h>
+  #include <linux/futex.h>
+  #include <linux/mempolicy.h>
+#endif
 
 #if defined(_WIN32)
 LARGE_INTEGER cprt_frequency;
@@ -98,6 +110,75 @@ void cprt_localtime_r(time_t *timep, struct tm *result)
 #endif
 }  /* cprt_localtime_r */
 
+/* Returns 1 if the CPU's time stamp counter runs at a constant rate and
+ * is synchronized across cores (x86 "invariant TSC"). */
+int cprt_tsc_invariant()
+{
+#if CPRT_HAVE_TSC && defined(_WIN32)
+  int regs[4];
+
+  __cpuid(regs, 0x80000000);
+  if ((unsigned int)regs[0] < 0x80000007) {
+    return 0;
+  }
+  __cpuid(regs, 0x80000007);
+  return (regs[3] & (1 << 8)) != 0;
+#elif CPRT_HAVE_TSC
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+    return 0;
+  }
+  return (edx & (1 << 8)) != 0;
+#else
+  return 0;
+#endif
+}  /* cprt_tsc_invariant */
+
+
+/* Block while "*addr" equals "val", until woken by cprt_futex_wake() or
+ * "timeout_ms" passes. May return early (spuriously). Without a futex-like
+ * OS call, just sleeps 1 ms. */
+void cprt_futex_wait(volatile int *addr, int val, int timeout_ms)
+{
+#if defined(_WIN32)
+  WaitOnAddress(addr, &val, sizeof(val), timeout_ms);
+#elif defined(__linux__)
+  struct timespec ts;
+
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+#else
+  if (*addr == val) {
+    CPRT_SLEEP_MS(1);
+  }
+#endif
+}  /* cprt_futex_wait */
+
+
+/* Wake one thread blocked in cprt_futex_wait() on "addr". */
+void cprt_futex_wake(volatile int *addr)
+{
+#if defined(_WIN32)
+  WakeByAddressSingle((void *)addr);
+#elif defined(__linux__)
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}  /* cprt_futex_wake */
+
+
+/* Wake all threads blocked in cprt_futex_wait() on "addr". */
+void cprt_futex_wake_all(volatile int *addr)
+{
+#if defined(_WIN32)
+  WakeByAddressAll((void *)addr);
+#elif defined(__linux__)
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}  /* cprt_futex_wake_all */
+
+
 char *cprt_strerror(int errnum, char *buffer, size_t buf_sz)
 {
 #if defined(_WIN32)
@@ -185,6 +266,123 @@ int cprt_try_affinity(uint64_t in_mask)
 }  /* cprt_try_affinity */
 
 
+/* Set the scheduling policy and priority of the calling thread.
+ * Returns 0 on success, -1 with errno set on failure. */
+int cprt_try_sched(int policy, int priority)
+{
+#if defined(_WIN32)
+  (void)policy;
+  if (! SetThreadPriority(GetCurrentThread(), priority)) {
+    errno = GetLastError();
+    return -1;
+  }
+
+#else
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = priority;
+  errno = pthread_setschedparam(pthread_self(), policy, &param);
+  if (errno != 0) {
+    return -1;
+  }
+#endif
+  return 0;
+}  /* cprt_try_sched */
+
+
+/* Name the calling thread (visible in ps, top, gdb). Linux limits names
+ * to 15 characters, so longer names are truncated.
+ * Returns 0 on success, -1 with errno set on failure. */
+int cprt_try_thread_name(const char *name)
+{
+#if defined(__linux__)
+  char short_name[16];
+  strncpy(short_name, name, sizeof(short_name) - 1);
+  short_name[sizeof(short_name) - 1] = '\0';
+  errno = pthread_setname_np(pthread_self(), short_name);
+  if (errno != 0) {
+    return -1;
+  }
+
+#elif defined(__APPLE__)
+  errno = pthread_setname_np(name);
+  if (errno != 0) {
+    return -1;
+  }
+
+#else /* Windows and other Unix: not supported, ignore. */
+  (void)name;
+#endif
+  return 0;
+}  /* cprt_try_thread_name */
+
+
+/* Bind the pages of a memory region to a NUMA node. Must be called before
+ * the pages are touched to take effect without migration.
+ * Returns 0 on success, -1 with errno set on failure. */
+int cprt_try_numa_bind(void *addr, size_t len, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+  unsigned long nodemask[4];
+  uintptr_t page_start = (uintptr_t)addr & ~((uintptr_t)4095);
+
+  if (node < 0 || node >= (int)(sizeof(nodemask) * 8)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(nodemask, 0, sizeof(nodemask));
+  nodemask[node / (sizeof(unsigned long) * 8)] =
+      1UL << (node % (sizeof(unsigned long) * 8));
+  len += (uintptr_t)addr - page_start;
+  if (syscall(SYS_mbind, (void *)page_start, len, MPOL_BIND, nodemask,
+      sizeof(nodemask) * 8 + 1, MPOL_MF_MOVE) != 0) {
+    return -1;
+  }
+
+#else /* No NUMA policy support. */
+  (void)addr; (void)len;
+  if (node != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+#endif
+  return 0;
+}  /* cprt_try_numa_bind */
+
+
+/* Check that a NUMA node exists and this process may allocate on it.
+ * Returns 0 if so, -1 with errno set if not. */
+int cprt_try_numa_node(int node)
+{
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+  unsigned long nodemask[4];
+  int mode;
+
+  if (node < 0 || node >= (int)(sizeof(nodemask) * 8)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(nodemask, 0, sizeof(nodemask));
+  if (syscall(SYS_get_mempolicy, &mode, nodemask, sizeof(nodemask) * 8 + 1,
+      NULL, MPOL_F_MEMS_ALLOWED) != 0) {
+    return -1;
+  }
+  if ((nodemask[node / (sizeof(unsigned long) * 8)]
+      & (1UL << (node % (sizeof(unsigned long) * 8)))) == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#else /* No NUMA policy support. */
+  if (node != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+#endif
+  return 0;
+}  /* cprt_try_numa_node */
+
+
 #define CPRT_MAX_EVENTS 1024
 int cprt_num_events = 0;
 int cprt_events[CPRT_MAX_EVENTS];
@@ -89,9 +89,44 @@ extern "C" {
 #if defined(_WIN32)
   #define CPRT_ATOMIC_INC_VAL(_p) InterlockedIncrement(_p)
   #define CPRT_ATOMIC_DEC_VAL(_p) InterlockedDecrement(_p)
+  #define CPRT_ATOMIC_ADD_VAL(_p, _v) (InterlockedExchangeAdd64((LONG64 *)(_p), (_v)) + (_v))
+  #define CPRT_ATOMIC_INC_RELAXED(_p) InterlockedIncrementNoFence((volatile LONG *)(_p))
+  #define CPRT_ATOMIC_XCHG(_p, _v) InterlockedExchange((volatile LONG *)(_p), (_v))
 #else  /* Unix */
   #define CPRT_ATOMIC_INC_VAL(_p) __sync_add_and_fetch(_p, 1)
   #define CPRT_ATOMIC_DEC_VAL(_p) __sync_sub_and_fetch(_p, 1)
+  #define CPRT_ATOMIC_ADD_VAL(_p, _v) __sync_add_and_fetch(_p, _v)
+  #define CPRT_ATOMIC_INC_RELAXED(_p) __atomic_add_fetch(_p, 1, __ATOMIC_RELAXED)
+  #define CPRT_ATOMIC_XCHG(_p, _v) __atomic_exchange_n(_p, _v, __ATOMIC_SEQ_CST)
+#endif
+
+/* Full compiler and CPU memory barrier. */
+#if defined(_WIN32)
+  #define CPRT_MEM_BARRIER MemoryBarrier()
+#else  /* Unix */
+  #define CPRT_MEM_BARRIER __sync_synchronize()
+#endif
+
+/* CPU time stamp counter. CPRT_HAVE_TSC is 0 if unavailable, in which
+ * case CPRT_RDTSC() returns 0 (and cprt_tsc_invariant() returns 0). */
+#if defined(_WIN32) && (defined(_M_X64) || defined(_M_IX86))
+  #include <intrin.h>
+  #define CPRT_HAVE_TSC 1
+  #define CPRT_RDTSC() ((uint64_t)__rdtsc())
+#elif defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  #define CPRT_HAVE_TSC 1
+  #define CPRT_RDTSC() ((uint64_t)__rdtsc())
+#else
+  #define CPRT_HAVE_TSC 0
+  #define CPRT_RDTSC() ((uint64_t)0)
+#endif
+
+/* Hint to the CPU that this is a spin loop. */
+#if CPRT_HAVE_TSC
+  #define CPRT_CPU_PAUSE() _mm_pause()
+#else
+  #define CPRT_CPU_PAUSE() do { } while (0)
 #endif
 
 /* Macro to approximate the basename() function. */
@@ -274,6 +309,7 @@ extern "C" {
   #define CPRT_STRDUP _strdup
   #define CPRT_SLEEP_SEC(s_) Sleep((s_)*1000)
   #define CPRT_SLEEP_MS Sleep
+  #define CPRT_YIELD() SwitchToThread()
   #define CPRT_STRTOK strtok_s
 
 #else  /* Unix */
@@ -281,6 +317,7 @@ extern "C" {
   #define CPRT_STRDUP strdup
   #define CPRT_SLEEP_SEC sleep
   #define CPRT_SLEEP_MS(ms_) usleep((ms_)*1000)
+  #define CPRT_YIELD() sched_yield()
   #define CPRT_STRTOK strtok_r
 #endif
 
@@ -437,6 +474,33 @@ extern "C" {
     CPRT_EOK0(errno = pthread_join(_tid, NULL))
 #endif
 
+/* Thread-local storage keys. The destructor is called with the thread's
+ * (non-NULL) value when that thread exits. */
+#if defined(_WIN32)
+  #define CPRT_TLS_KEY_T DWORD
+  #define CPRT_TLS_DESTRUCTOR VOID WINAPI
+  #define CPRT_TLS_KEY_CREATE(_k, _destructor) do { \
+    (_k) = FlsAlloc(_destructor); \
+    if ((_k) == FLS_OUT_OF_INDEXES) { \
+      errno = GetLastError(); \
+      CPRT_PERRNO("FlsAlloc"); \
+      CPRT_ERR_EXIT; \
+    } \
+  } while (0)
+  #define CPRT_TLS_KEY_DELETE(_k) FlsFree(_k)
+  #define CPRT_TLS_GET(_k) FlsGetValue(_k)
+  #define CPRT_TLS_SET(_k, _v) FlsSetValue((_k), (_v))
+
+#else  /* Unix */
+  #define CPRT_TLS_KEY_T pthread_key_t
+  #define CPRT_TLS_DESTRUCTOR void
+  #define CPRT_TLS_KEY_CREATE(_k, _destructor) \
+    CPRT_EOK0(errno = pthread_key_create(&(_k), _destructor))
+  #define CPRT_TLS_KEY_DELETE(_k) pthread_key_delete(_k)
+  #define CPRT_TLS_GET(_k) pthread_getspecific(_k)
+  #define CPRT_TLS_SET(_k, _v) CPRT_EOK0(errno = pthread_setspecific((_k), (_v)))
+#endif
+
 #define CPRT_CPU_ZERO(_cprt_cpuset) do { \
   uint64_t *_cprt_cpuset_p = (_cprt_cpuset); \
   *_cprt_cpuset_p = 0; \
@@ -487,8 +551,16 @@ extern "C" {
 char *cprt_strerror(int errnum, char *buffer, size_t buf_sz);
 void cprt_set_affinity(uint64_t in_mask);
 int cprt_try_affinity(uint64_t in_mask);
+int cprt_try_sched(int policy, int priority);
+int cprt_try_thread_name(const char *name);
+int cprt_try_numa_bind(void *addr, size_t len, int node);
+int cprt_try_numa_node(int node);
 void cprt_inittime();
 void cprt_localtime_r(time_t *timep, struct tm *result);
+int cprt_tsc_invariant();
+void cprt_futex_wait(volatile int *addr, int val, int timeout_ms);
+void cprt_futex_wake(volatile int *addr);
+void cprt_futex_wake_all(volatile int *addr);
 
 #if defined(_WIN32)
   int cprt_timeofday(struct cprt_timeval *tv, void *unused_tz);
@@ -14,15 +14,22 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #if ! defined(_WIN32)
   #include <stdlib.h>
   #include <unistd.h>
   #include <inttypes.h>
+  #include <errno.h>
+  #include <fcntl.h>
   #include <sys/time.h>
+  #include <sys/uio.h>
+  #include <sys/mman.h>
 #endif
 
 #include "lgr.h"
+#include "lgr_fmt.h"
+#include "lgr_uring.h"
 
 CPRT_THREAD_ENTRYPOINT lgr_thread(void *in_arg);
 
@@ -39,6 +46,14 @@ static char *lgr_errs[LGR_LAST_ERR + 3] = {
   "QFULL",
   "EXITING",
   "SEVERITY",
+  "FLAGS",
+  "RINGSIZE",
+  "OUTBUFSIZE",
+  "RESERVE",
+  "MLOCK",
+  "THREAD",
+  "NUMA",
+  "CLASSES",
   "BAD_LGR_ERR",
   NULL};
 #define BAD_LGR_ERR (sizeof(lgr_errs)/sizeof(lgr_errs[0]) - 2)
@@ -57,6 +72,8 @@ char *lgr_err2str(lgr_err_t lgr_err)
  * corresponding "LGR_SEV_*" constant definitions in "lgr.h".
  * It is used by the lgr_sev2str() function. */
 static char *lgr_sevs[LGR_LAST_SEV + 3] = {
+  "TRACE",
+  "DEBUG",
   "FYI",
   "ATTN",
   "WARN",
@@ -85,22 +102,670 @@ static int is_power_2(unsigned int n)
 }  /* is_power_2 */
 
 
+/* Called after enqueuing a log (LGR_FLAGS_WAKEUP). Makes a system call only
+ * if the logger thread is parked (see lgr_wait()). */
+static void lgr_wake(lgr_t *lgr)
+{
+  /* Order the enqueue before reading "sleeping"; lgr_wait() does the
+   * reverse. So either lgr_wait() sees the log, or this sees it parking. */
+  CPRT_MEM_BARRIER;
+  if (lgr->sleeping) {
+    lgr->sleeping = 0;
+    cprt_futex_wake(&(lgr->sleeping));
+  }
+}  /* lgr_wake */
+
+
+/* Enqueue a log to the logger thread: to "log_q" (an app thread's queue or
+ * lgr->log_q), or to lgr->log_qm with LGR_FLAGS_MPMC. */
+static qerr_t lgr_enq_log(lgr_t *lgr, q_t *log_q, lgr_log_t *log)
+{
+  if (log_q == NULL) {
+    return qm_enq(lgr->log_qm, (void *)log);
+  }
+  return q_enq(log_q, (void *)log);
+}  /* lgr_enq_log */
+
+
+/* Returns 1 if lgr->log_q (or log_qm) has no log ready. */
+static int lgr_log_q_empty(lgr_t *lgr)
+{
+  if (lgr->flags & LGR_FLAGS_MPMC) {
+    return qm_is_empty(lgr->log_qm);
+  }
+  return q_is_empty(lgr->log_q);
+}  /* lgr_log_q_empty */
+
+
+/* Allocate "size" bytes for log buffers (or the byte ring), page aligned,
+ * per LGR_FLAGS_HUGEPAGES, LGR_FLAGS_PREFAULT, LGR_FLAGS_MLOCK, and
+ * lgr_attr_t.numa_node.
+ * Sets *rtn_size to the size actually allocated (rounded up to a hugepage)
+ * and *rtn_mapped to 1 if the arena is a MAP_HUGETLB mapping.
+ * Returns NULL on failure with *rtn_err set. */
+static void *lgr_arena_alloc(lgr_t *lgr, size_t size, size_t *rtn_size,
+    int *rtn_mapped, lgr_err_t *rtn_err)
+{
+  void *arena = NULL;
+
+  *rtn_mapped = 0;
+  if (lgr->flags & LGR_FLAGS_HUGEPAGES) {
+    size = (size + LGR_HUGEPAGE_SIZE - 1) & ~((size_t)LGR_HUGEPAGE_SIZE - 1);
+#if defined(MAP_HUGETLB)
+    arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (arena == MAP_FAILED) {
+      arena = NULL;
+    }
+    else {
+      *rtn_mapped = 1;
+    }
+#endif
+    if (arena == NULL) {
+      /* No reserved hugepages; ask for transparent hugepages instead. */
+      if (posix_memalign(&arena, LGR_HUGEPAGE_SIZE, size) != 0) {
+        *rtn_err = LGR_ERR_MALLOC; return NULL;
+      }
+#if defined(MADV_HUGEPAGE)
+      (void)madvise(arena, size, MADV_HUGEPAGE);
+#endif
+    }
+  }
+  else {
+    if (posix_memalign(&arena, 4096, size) != 0) {
+      *rtn_err = LGR_ERR_MALLOC; return NULL;
+    }
+  }
+
+  if (lgr->numa_node >= 0) {
+    /* Before any page is touched, so no migration is needed. */
+    if (cprt_try_numa_bind(arena, size, lgr->numa_node) != 0) {
+      if (*rtn_mapped) { munmap(arena, size); } else { free(arena); }
+      *rtn_err = LGR_ERR_NUMA; return NULL;
+    }
+  }
+  if (lgr->flags & LGR_FLAGS_PREFAULT) {
+    memset(arena, 0, size);  /* Take the page faults now. */
+  }
+  if (lgr->flags & LGR_FLAGS_MLOCK) {
+    if (mlock(arena, size) != 0) {
+      if (*rtn_mapped) { munmap(arena, size); } else { free(arena); }
+      *rtn_err = LGR_ERR_MLOCK; return NULL;
+    }
+  }
+
+  *rtn_size = size;
+  return arena;
+}  /* lgr_arena_alloc */
+
+
+static void lgr_arena_free(lgr_t *lgr, void *arena, size_t size, int mapped)
+{
+  if (arena == NULL) {
+    return;
+  }
+  if (mapped) {
+    munmap(arena, size);  /* Also unlocks. */
+  }
+  else {
+    if (lgr->flags & LGR_FLAGS_MLOCK) {
+      munlock(arena, size);
+    }
+    free(arena);
+  }
+}  /* lgr_arena_free */
+
+
+/* Carve "num_logs" log buffers for messages up to "msg_size" out of "arena"
+ * and add them to a pool. Each buffer is rounded up to LGR_LOG_ALIGN bytes.
+ * Returns the first byte after them. */
+static char *lgr_arena_fill(lgr_t *lgr, char *arena, unsigned int num_logs,
+    unsigned int msg_size, q_t *pool_q)
+{
+  /* Leave extra room in string buffer for NUL and truncate test. */
+  size_t rec_size = sizeof(lgr_log_t) + msg_size + 2;
+  size_t stride = (rec_size + LGR_LOG_ALIGN - 1) & ~((size_t)LGR_LOG_ALIGN - 1);
+  unsigned int i;
+
+  for (i = 0; i < num_logs; i++) {
+    lgr_log_t *log = (lgr_log_t *)(arena + i * stride);
+    qerr_t qerr;
+
+    log->type = LGR_LOG_TYPE_MSG;
+    log->pool_q = pool_q;  /* NULL with LGR_FLAGS_MPMC. */
+    log->rec_size = rec_size;
+    if (pool_q == NULL) {
+      qerr = qm_enq(lgr->pool_qm, log);
+    }
+    else {
+      qerr = q_enq(pool_q, log);
+    }
+    CPRT_ASSERT(qerr == QERR_OK);
+  }
+  return arena + num_logs * stride;
+}  /* lgr_arena_fill */
+
+
+/* Size of an arena holding "num_logs" log buffers for messages up to
+ * "msg_size". */
+static size_t lgr_arena_size(unsigned int num_logs, unsigned int msg_size)
+{
+  size_t rec_size = sizeof(lgr_log_t) + msg_size + 2;
+  return (size_t)num_logs *
+      ((rec_size + LGR_LOG_ALIGN - 1) & ~((size_t)LGR_LOG_ALIGN - 1));
+}  /* lgr_arena_size */
+
+
+/* Add a chunk of up to pool_chunk_logs log buffers to pool_q, without going
+ * over pool_max_logs. Called by lgr_create() for the first chunk and by the
+ * logger thread after that (pool_q's producer either way). */
+static lgr_err_t lgr_pool_grow(lgr_t *lgr)
+{
+  lgr_chunk_t *chunk = &(lgr->chunks[lgr->num_chunks]);
+  unsigned int num_logs = lgr->pool_max_logs - lgr->pool_logs;
+  lgr_err_t err = LGR_ERR_MALLOC;
+
+  if (num_logs > lgr->pool_chunk_logs) {
+    num_logs = lgr->pool_chunk_logs;
+  }
+  chunk->arena = lgr_arena_alloc(lgr,
+      lgr_arena_size(num_logs, lgr->max_msg_size),
+      &(chunk->arena_size), &(chunk->arena_mapped), &err);
+  if (chunk->arena == NULL) {
+    return err;
+  }
+  chunk->num_logs = num_logs;
+  lgr_arena_fill(lgr, chunk->arena, num_logs, lgr->max_msg_size, lgr->pool_q);
+  lgr->num_chunks++;
+  lgr->pool_logs += num_logs;
+
+  return LGR_ERR_OK;
+}  /* lgr_pool_grow */
+
+
+/* Free a registered (or partially-registered) app thread's queues. */
+static void lgr_thread_free(lgr_thread_t *thr)
+{
+  /* Log buffers are all in the arena. */
+  if (thr->log_q != NULL) {
+    q_delete(thr->log_q);
+  }
+  if (thr->pool_q != NULL) {
+    q_delete(thr->pool_q);
+  }
+  lgr_arena_free(thr->lgr, thr->arena, thr->arena_size, thr->arena_mapped);
+  free(thr);
+}  /* lgr_thread_free */
+
+
+/* TLS destructor, called when a registered app thread exits. The logger
+ * thread frees the thread's queues after it drains them. */
+static CPRT_TLS_DESTRUCTOR lgr_thread_exit(void *in_arg)
+{
+  lgr_thread_t *thr = (lgr_thread_t *)in_arg;
+
+  CPRT_MEM_BARRIER;  /* Make app thread's last enqueue visible first. */
+  thr->exited = 1;
+}  /* lgr_thread_exit */
+
+
+/* Called by lgr_log() the first time an app thread logs with
+ * LGR_FLAGS_PER_THREAD. This is the only place (other than overflow)
+ * that per-thread mode takes a lock. */
+static lgr_err_t lgr_thread_register(lgr_t *lgr, lgr_thread_t **rtn_thr)
+{
+  lgr_thread_t *thr;
+  lgr_err_t err;
+
+  thr = (lgr_thread_t *)malloc(sizeof(lgr_thread_t));
+  if (thr == NULL) { return LGR_ERR_MALLOC; }
+  thr->lgr = lgr;
+  thr->pool_q = NULL;
+  thr->log_q = NULL;
+  thr->arena = NULL;
+  thr->exited = 0;
+
+  if (q_create(&(thr->pool_q), lgr->q_size) != QERR_OK) {
+    lgr_thread_free(thr); return LGR_ERR_MALLOC;
+  }
+  if (q_create(&(thr->log_q), lgr->q_size) != QERR_OK) {
+    lgr_thread_free(thr); return LGR_ERR_MALLOC;
+  }
+
+  /* Only this thread's logs go into its log_q (overflow and quit logs use
+   * the shared lgr->log_q), so the pool can fill every usable slot. */
+  thr->arena = lgr_arena_alloc(lgr,
+      lgr_arena_size(lgr->q_size - 1, lgr->max_msg_size),
+      &(thr->arena_size), &(thr->arena_mapped), &err);
+  if (thr->arena == NULL) { lgr_thread_free(thr); return err; }
+  lgr_arena_fill(lgr, thr->arena, lgr->q_size - 1, lgr->max_msg_size,
+      thr->pool_q);
+
+  /* Publish to logger thread. It walks the list without the lock, so the
+   * new entry must be fully initialized before it becomes the head. */
+  CPRT_SPIN_LOCK(lgr->log_lock);  /* PER_THREAD excludes NOLOCK. */
+  thr->next = lgr->threads;
+  CPRT_MEM_BARRIER;
+  lgr->threads = thr;
+  CPRT_SPIN_UNLOCK(lgr->log_lock);
+
+  CPRT_TLS_SET(lgr->thread_key, thr);
+
+  *rtn_thr = thr;
+  return LGR_ERR_OK;
+}  /* lgr_thread_register */
+
+
+/* Take a (TSC, wall clock) sample. The TSC is read on both sides of the
+ * clock read; the tightest of a few tries is kept. */
+static void lgr_tsc_sample(uint64_t *rtn_tsc, int64_t *rtn_usec)
+{
+  struct cprt_timeval tv;
+  uint64_t tsc1, tsc2;
+  uint64_t best_span = (uint64_t)-1;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    tsc1 = CPRT_RDTSC();
+    CPRT_TIMEOFDAY(&tv, NULL);
+    tsc2 = CPRT_RDTSC();
+    if (tsc2 - tsc1 < best_span) {
+      best_span = tsc2 - tsc1;
+      *rtn_tsc = tsc1 + (tsc2 - tsc1) / 2;
+      *rtn_usec = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+  }
+}  /* lgr_tsc_sample */
+
+
+/* Refresh the TSC calibration (LGR_FLAGS_TSC_TS). The rate is measured
+ * over as long a baseline as possible; the reference point is moved to the
+ * newest sample so that conversion errors don't accumulate. */
+static void lgr_tsc_calibrate(lgr_t *lgr)
+{
+  uint64_t tsc = 0;
+  int64_t usec = 0;
+
+  lgr_tsc_sample(&tsc, &usec);
+  if (usec > lgr->usec_base && tsc > lgr->tsc_base) {
+    double tsc_per_usec = (double)(tsc - lgr->tsc_base) /
+        (double)(usec - lgr->usec_base);
+    /* A big change means the wall clock was stepped; start over. */
+    if (tsc_per_usec > lgr->tsc_per_usec * 1.01
+        || tsc_per_usec < lgr->tsc_per_usec * 0.99) {
+      lgr->tsc_base = tsc;
+      lgr->usec_base = usec;
+    }
+    else {
+      lgr->tsc_per_usec = tsc_per_usec;
+    }
+  }
+  else {
+    lgr->tsc_base = tsc;
+    lgr->usec_base = usec;
+  }
+  lgr->tsc_ref = tsc;
+  lgr->usec_ref = usec;
+  lgr->tsc_next_cal = tsc + (uint64_t)(lgr->tsc_per_usec * 1000000);
+}  /* lgr_tsc_calibrate */
+
+
+/* Convert a TSC time stamp to wall clock time (LGR_FLAGS_TSC_TS). */
+static void lgr_tsc_to_tv(lgr_t *lgr, uint64_t tsc, struct cprt_timeval *tv)
+{
+  int64_t usec = lgr->usec_ref +
+      (int64_t)((double)(int64_t)(tsc - lgr->tsc_ref) / lgr->tsc_per_usec);
+
+  tv->tv_sec = (time_t)(usec / 1000000);
+  tv->tv_usec = (long)(usec % 1000000);
+}  /* lgr_tsc_to_tv */
+
+
+/* LGR_FLAGS_STATS time stamp: TSC ticks with LGR_FLAGS_TSC_TS (cheaper),
+ * otherwise monotonic nanoseconds. */
+static uint64_t lgr_stamp(lgr_t *lgr)
+{
+  struct cprt_timespec ts;
+
+  if (lgr->flags & LGR_FLAGS_TSC_TS) {
+    return CPRT_RDTSC();
+  }
+  CPRT_GETTIME(&ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}  /* lgr_stamp */
+
+
+/* Convert a difference of two lgr_stamp()s to nanoseconds. Logger thread
+ * only (uses its TSC calibration). */
+static uint64_t lgr_stamp_ns(lgr_t *lgr, uint64_t stamp_diff)
+{
+  if (lgr->flags & LGR_FLAGS_TSC_TS) {
+    return (uint64_t)((double)stamp_diff * 1000.0 / lgr->tsc_per_usec);
+  }
+  return stamp_diff;
+}  /* lgr_stamp_ns */
+
+
+/* Logger thread only; no lock needed. */
+static void lgr_hist_add(lgr_hist_t *hist, uint64_t ns)
+{
+  int b;
+
+#if defined(__GNUC__)
+  b = (ns < 2) ? 0 : 63 - __builtin_clzll(ns);
+#else
+  for (b = 0; (ns >> (b + 1)) != 0; b++) {
+  }
+#endif
+  if (b >= LGR_HIST_BUCKETS) {
+    b = LGR_HIST_BUCKETS - 1;
+  }
+  hist->buckets[b]++;
+  hist->cnt++;
+  hist->sum_ns += ns;
+  if (ns > hist->max_ns) {
+    hist->max_ns = ns;
+  }
+}  /* lgr_hist_add */
+
+
+/* Returns an upper bound on the "pct" percentile (0-100) of "hist": the
+ * end of the bucket that contains it (never more than max_ns). */
+uint64_t lgr_hist_pct(const lgr_hist_t *hist, double pct)
+{
+  uint64_t target, sum;
+  int b;
+
+  if (hist->cnt == 0) {
+    return 0;
+  }
+  target = (uint64_t)((double)hist->cnt * pct / 100.0);
+  if (target < 1) {
+    target = 1;
+  }
+  sum = 0;
+  for (b = 0; b < LGR_HIST_BUCKETS - 1; b++) {
+    sum += hist->buckets[b];
+    if (sum >= target) {
+      uint64_t bound = ((uint64_t)2 << b) - 1;
+      return (bound < hist->max_ns) ? bound : hist->max_ns;
+    }
+  }
+  return hist->max_ns;
+}  /* lgr_hist_pct */
+
+
+/* Round up to a multiple of LGR_RING_ALIGN. */
+#define LGR_RING_ROUND(_n) (((_n) + (LGR_RING_ALIGN - 1)) & ~(uint64_t)(LGR_RING_ALIGN - 1))
+
+
+void lgr_attr_init(lgr_attr_t *attr)
+{
+  int i;
+
+  attr->max_msg_size = 1024;
+  attr->q_size = 1024;
+  attr->sleep_ms = 1;
+  attr->flags = 0;
+  attr->file_prefix = NULL;
+  attr->max_file_size_mb = 1024;
+  attr->ring_size = 0;
+  attr->out_buf_size = 256 * 1024;
+  attr->spin_us = 50;
+  attr->block_us = 0;
+  attr->min_sev = LGR_SEV_TRACE;
+  attr->cpu_mask = 0;
+  attr->sched_policy = -1;
+  attr->sched_priority = 0;
+  attr->thread_name = NULL;
+  attr->numa_node = -1;
+  attr->pool_chunk_logs = 0;
+  attr->pool_shrink_ms = 0;
+  attr->coalesce_ms = 1000;
+  for (i = 0; i < LGR_MAX_CLASSES; i++) {
+    attr->class_msg_size[i] = 0;
+    attr->class_logs[i] = 0;
+  }
+  for (i = 0; i <= LGR_LAST_SEV; i++) {
+    attr->sev_reserve[i] = 0;
+  }
+}  /* lgr_attr_init */
+
+
 lgr_err_t lgr_create(lgr_t **rtn_lgr, unsigned int max_msg_size,
     unsigned int q_size, unsigned int sleep_ms, uint32_t flags,
     char *file_prefix, int max_file_size_mb)
+{
+  lgr_attr_t attr;
+
+  lgr_attr_init(&attr);
+  attr.max_msg_size = max_msg_size;
+  attr.q_size = q_size;
+  attr.sleep_ms = sleep_ms;
+  attr.flags = flags;
+  attr.file_prefix = file_prefix;
+  attr.max_file_size_mb = max_file_size_mb;
+
+  return lgr_create_attr(rtn_lgr, &attr);
+}  /* lgr_create */
+
+
+/* Free everything an lgr_t owns, and the lgr_t. Used by lgr_delete() once
+ * the logger thread has exited, and by lgr_create_attr() when it fails part
+ * way (members not created yet are NULL). */
+static void lgr_free(lgr_t *lgr)
 {
   int i;
-  qerr_t qerr;
+
+  if (lgr->flags & LGR_FLAGS_PER_THREAD) {
+    /* Delete the key first so that exiting app threads stop referencing
+     * their (about to be freed) lgr_thread_t. */
+    CPRT_TLS_KEY_DELETE(lgr->thread_key);
+    while (lgr->threads != NULL) {
+      lgr_thread_t *thr = lgr->threads;
+      lgr->threads = thr->next;
+      lgr_thread_free(thr);
+    }
+  }
+
+  if (lgr->log_q != NULL) {
+    lgr_log_t *log;
+    /* By now there should be no remaining entries in the log q.
+     * But just in case, minimize memory leaks. */
+    while (q_deq(lgr->log_q, (void **)&log) == QERR_OK) {
+      /* Log buffers are all in the arena. */
+    }
+    q_delete(lgr->log_q);
+    lgr->log_q = NULL;
+  }
+
+  if (lgr->pool_q != NULL) {
+    q_delete(lgr->pool_q);
+    lgr->pool_q = NULL;
+  }
+  for (i = 0; i < LGR_MAX_CLASSES; i++) {
+    if (lgr->class_pool_q[i] != NULL) {
+      q_delete(lgr->class_pool_q[i]);
+      lgr->class_pool_q[i] = NULL;
+    }
+  }
+  if (lgr->log_qm != NULL) {
+    qm_delete(lgr->log_qm);
+    lgr->log_qm = NULL;
+  }
+  if (lgr->pool_qm != NULL) {
+    qm_delete(lgr->pool_qm);
+    lgr->pool_qm = NULL;
+  }
+
+  if (lgr->arena != NULL) {
+    lgr_arena_free(lgr, lgr->arena, lgr->arena_size, lgr->arena_mapped);
+    lgr->arena = NULL;
+  }
+  if (lgr->chunks != NULL) {
+    for (i = 0; i < lgr->num_chunks; i++) {
+      lgr_arena_free(lgr, lgr->chunks[i].arena, lgr->chunks[i].arena_size,
+          lgr->chunks[i].arena_mapped);
+    }
+    free(lgr->chunks);
+    lgr->chunks = NULL;
+  }
+  if (lgr->pool_scratch != NULL) {
+    free(lgr->pool_scratch);
+    lgr->pool_scratch = NULL;
+  }
+  if (lgr->ring_buf != NULL) {
+    lgr_arena_free(lgr, lgr->ring_buf, lgr->arena_size, lgr->arena_mapped);
+    lgr->ring_buf = NULL;
+  }
+  if (lgr->repeat_msg != NULL) {
+    free(lgr->repeat_msg);
+    lgr->repeat_msg = NULL;
+  }
+  if (lgr->fmt_buf != NULL) {
+    free(lgr->fmt_buf);
+    lgr->fmt_buf = NULL;
+  }
+  if (lgr->uring != NULL) {
+    lgr_uring_delete(lgr->uring);
+    lgr->uring = NULL;
+  }
+  for (i = 0; i < 2; i++) {
+    if (lgr->out_bufs[i] != NULL) {
+      free(lgr->out_bufs[i]);
+      lgr->out_bufs[i] = NULL;
+    }
+  }
+  if (lgr->fmt_tbl != NULL) {
+    free((void *)lgr->fmt_tbl);
+    lgr->fmt_tbl = NULL;
+  }
+  if (lgr->fmt_tbl_ids != NULL) {
+    free(lgr->fmt_tbl_ids);
+    lgr->fmt_tbl_ids = NULL;
+  }
+
+  if (lgr->file_full_name != NULL) {
+    free(lgr->file_full_name);
+    lgr->file_full_name = NULL;
+  }
+  if (lgr->file_prefix != NULL) {
+    free(lgr->file_prefix);
+    lgr->file_prefix = NULL;
+  }
+
+  if (! (lgr->flags & LGR_FLAGS_NOLOCK)) {
+    CPRT_SPIN_DELETE(lgr->log_lock);
+  }
+  CPRT_SPIN_DELETE(lgr->overflow_lock);
+  CPRT_SPIN_DELETE(lgr->site_lock);
+
+  free(lgr);
+}  /* lgr_free */
+
+
+lgr_err_t lgr_create_attr(lgr_t **rtn_lgr, lgr_attr_t *attr)
+{
+  unsigned int max_msg_size = attr->max_msg_size;
+  unsigned int q_size = attr->q_size;
+  unsigned int sleep_ms = attr->sleep_ms;
+  uint32_t flags = attr->flags;
+  char *file_prefix = attr->file_prefix;
+  int max_file_size_mb = attr->max_file_size_mb;
+  uint64_t ring_size = attr->ring_size;
+  unsigned int ring_rec_max = 0;
+  int num_classes;
+  int i;
   lgr_t *lgr = NULL;
 
   /* Sanity: make sure lgr error codes are in sync with strings. */
   CPRT_ASSERT(LGR_LAST_ERR == BAD_LGR_ERR - 1);
   /* Sanity: make sure severity codes are in sync with strings. */
   CPRT_ASSERT(LGR_LAST_SEV == BAD_LGR_SEV - 1);
+  /* Sanity: a log header must fit in a ring wrap gap. */
+  CPRT_ASSERT(offsetof(lgr_log_t, msg) <= LGR_RING_ALIGN);
 
   if (max_msg_size <= 0) { return LGR_ERR_MSGSIZE; }
   if ((q_size <= 0) || (! is_power_2(q_size))) { return LGR_ERR_QSIZE; }
   if (max_file_size_mb <= 0) { return LGR_ERR_FILESIZE; }
+  if (attr->out_buf_size == 0) { return LGR_ERR_OUTBUFSIZE; }
+  if (attr->min_sev > LGR_LAST_SEV) { return LGR_ERR_SEVERITY; }
+  for (i = 0; i <= LGR_LAST_SEV; i++) {
+    /* Pools hold q_size - 3 logs; leave at least one usable. */
+    if (attr->sev_reserve[i] > 0 && attr->sev_reserve[i] + 3 >= q_size) {
+      return LGR_ERR_RESERVE;
+    }
+  }
+  if ((flags & LGR_FLAGS_BYTE_RING) && (flags & LGR_FLAGS_PER_THREAD)) {
+    return LGR_ERR_FLAGS;
+  }
+  /* App threads register and the logger unlinks them under log_lock. */
+  if ((flags & LGR_FLAGS_NOLOCK) && (flags & LGR_FLAGS_PER_THREAD)) {
+    return LGR_ERR_FLAGS;
+  }
+  if ((flags & LGR_FLAGS_MMAP) && (flags & LGR_FLAGS_IO_URING)) {
+    return LGR_ERR_FLAGS;
+  }
+  if ((flags & LGR_FLAGS_MPMC)
+      && (flags & (LGR_FLAGS_PER_THREAD | LGR_FLAGS_BYTE_RING))) {
+    return LGR_ERR_FLAGS;
+  }
+  if ((flags & LGR_FLAGS_TSC_TS) && (flags & LGR_FLAGS_DEFER_TS)) {
+    return LGR_ERR_FLAGS;
+  }
+  num_classes = 0;
+  if (attr->class_msg_size[0] > 0) {
+    unsigned int tot_logs = 0;
+
+    if (flags & (LGR_FLAGS_PER_THREAD | LGR_FLAGS_BYTE_RING
+        | LGR_FLAGS_MPMC)) {
+      return LGR_ERR_FLAGS;
+    }
+    while (num_classes < LGR_MAX_CLASSES
+        && attr->class_msg_size[num_classes] > 0) {
+      if (attr->class_logs[num_classes] == 0
+          || (num_classes > 0 && attr->class_msg_size[num_classes]
+              <= attr->class_msg_size[num_classes - 1])) {
+        return LGR_ERR_CLASSES;
+      }
+      tot_logs += attr->class_logs[num_classes];
+      num_classes++;
+    }
+    if (attr->class_msg_size[num_classes - 1] != max_msg_size
+        || tot_logs > q_size - 3) {
+      return LGR_ERR_CLASSES;
+    }
+  }
+  if (attr->pool_chunk_logs > 0) {
+    /* The logger thread grows and shrinks the single shared pool_q. */
+    if ((flags & (LGR_FLAGS_PER_THREAD | LGR_FLAGS_BYTE_RING
+        | LGR_FLAGS_MPMC)) || num_classes > 0) {
+      return LGR_ERR_FLAGS;
+    }
+    /* Shrinking takes logs from pool_q, so it needs log_lock. */
+    if (attr->pool_shrink_ms > 0 && (flags & LGR_FLAGS_NOLOCK)) {
+      return LGR_ERR_FLAGS;
+    }
+  }
+  if ((flags & LGR_FLAGS_TSC_TS) && ! cprt_tsc_invariant()) {
+    /* TSC not usable as a clock; time stamp with gettimeofday. */
+    flags &= ~LGR_FLAGS_TSC_TS;
+  }
+  if (flags & LGR_FLAGS_BYTE_RING) {
+    /* Leave extra room in string buffer for NUL and truncate test. */
+    ring_rec_max = LGR_RING_ROUND(offsetof(lgr_log_t, msg) + max_msg_size + 2);
+    if (ring_size == 0) {
+      ring_size = (uint64_t)q_size * 256;
+    }
+    /* Must be able to hold at least two max-sized logs. */
+    if ((ring_size & (ring_size - 1)) != 0 || ring_size < 2 * ring_rec_max) {
+      return LGR_ERR_RINGSIZE;
+    }
+  }
+  /* Catch a bad node before anything is allocated and bound. */
+  if (attr->numa_node >= 0 && cprt_try_numa_node(attr->numa_node) != 0) {
+    return LGR_ERR_NUMA;
+  }
 
   lgr = malloc(sizeof(lgr_t));
   if (lgr == NULL) { return LGR_ERR_MALLOC; }
@@ -113,15 +778,81 @@ lgr_err_t lgr_create(lgr_t **rtn_lgr, unsigned int max_msg_size,
   lgr->file_full_name = NULL;
   lgr->max_file_size_bytes = (uint64_t)max_file_size_mb * 1024 * 1024;
   lgr->cur_file_size_bytes = 0;
+  lgr->cur_out_fd = -1;
+  lgr->out_bufs[0] = NULL;
+  lgr->out_bufs[1] = NULL;
+  lgr->out_buf_idx = 0;
+  lgr->out_len = 0;
+  lgr->out_buf_size = attr->out_buf_size;
+  lgr->out_inflight[0] = 0;
+  lgr->out_inflight[1] = 0;
+  lgr->out_file_off = 0;
+  lgr->uring = NULL;
+  lgr->spin_us = attr->spin_us;
+  lgr->sleeping = 0;
+  lgr->block_us = attr->block_us;
+  lgr->min_sev = attr->min_sev;
+  lgr->block_waiters = 0;
+  lgr->free_seq = 0;
+  lgr->blocked_logs = 0;
+  lgr->blocked_ns = 0;
+  lgr->blocked_timeouts = 0;
+  lgr->cpu_mask = attr->cpu_mask;
+  lgr->sched_policy = attr->sched_policy;
+  lgr->sched_priority = attr->sched_priority;
+  lgr->thread_name[0] = '\0';
+  if (attr->thread_name != NULL) {
+    strncpy(lgr->thread_name, attr->thread_name,
+        sizeof(lgr->thread_name) - 1);
+    lgr->thread_name[sizeof(lgr->thread_name) - 1] = '\0';
+  }
+  lgr->numa_node = attr->numa_node;
+  lgr->thread_err = LGR_ERR_OK;
+  lgr->out_mmap = 0;
+  lgr->mmap_win = NULL;
+  lgr->mmap_win_off = 0;
+  lgr->mmap_alloc_size = 0;
 
   lgr->state = LGR_STATE_INITIALIZING;
   lgr->pool_q = NULL;
   lgr->log_q = NULL;
+  lgr->pool_qm = NULL;
+  lgr->log_qm = NULL;
+  lgr->num_classes = num_classes;
+  for (i = 0; i < LGR_MAX_CLASSES; i++) {
+    lgr->class_msg_size[i] = attr->class_msg_size[i];
+    lgr->class_pool_q[i] = NULL;
+    lgr->class_spare[i] = NULL;
+  }
+
+  lgr->coalesce_ms = attr->coalesce_ms;
+  lgr->repeat_msg = NULL;
+  lgr->repeat_valid = 0;
+  lgr->repeat_cnt = 0;
+  lgr->repeat_total = 0;
+
+  lgr->pool_chunk_logs = attr->pool_chunk_logs;
+  if (lgr->pool_chunk_logs > q_size - 3) {
+    lgr->pool_chunk_logs = q_size - 3;
+  }
+  lgr->pool_shrink_ms = attr->pool_shrink_ms;
+  lgr->pool_logs = 0;
+  lgr->pool_max_logs = q_size - 3;
+  lgr->chunks = NULL;
+  lgr->num_chunks = 0;
+  lgr->pool_peak = 0;
+  lgr->pool_scratch = NULL;
+  lgr->pool_grows = 0;
+  lgr->pool_shrinks = 0;
+  lgr->pool_overflows = 0;
 
   /* Per-severity counters. */
   for (i = 0; i <= LGR_LAST_SEV; i++) {
     lgr->overflows[i] = 0;
     lgr->file_size_drops[i] = 0;
+    lgr->overflows_total[i] = 0;
+    lgr->file_size_drops_total[i] = 0;
+    lgr->sev_reserve[i] = attr->sev_reserve[i];
   }
   lgr->overflow_log.type = LGR_LOG_TYPE_OVERFLOW;
   lgr->overflow_log_available = 1;
@@ -132,244 +863,1512 @@ lgr_err_t lgr_create(lgr_t **rtn_lgr, unsigned int max_msg_size,
     CPRT_SPIN_INIT(lgr->log_lock);
   }
   CPRT_SPIN_INIT(lgr->overflow_lock);  /* See doc #locking. */
+  CPRT_SPIN_INIT(lgr->site_lock);
+  lgr->sites = NULL;
+
+  lgr->logs_total = 0;
+  lgr->suppressed_total = 0;
+  lgr->log_q_hwm = 0;
+  memset(&(lgr->call_hist), 0, sizeof(lgr->call_hist));
+  memset(&(lgr->queue_hist), 0, sizeof(lgr->queue_hist));
+  memset(&(lgr->write_hist), 0, sizeof(lgr->write_hist));
+
+  lgr->threads = NULL;
+  if (lgr->flags & LGR_FLAGS_PER_THREAD) {
+    CPRT_TLS_KEY_CREATE(lgr->thread_key, lgr_thread_exit);
+  }
+
+  lgr->arena = NULL;
+  lgr->arena_size = 0;
+  lgr->arena_mapped = 0;
+  lgr->ring_buf = NULL;
+  lgr->ring_size = ring_size;
+  lgr->ring_tail = 0;
+  lgr->ring_head = 0;
+  lgr->ring_rec_max = ring_rec_max;
+  lgr->ring_resv_cnt = 0;
+  lgr->ring_rel_cnt = 0;
+  lgr->fmt_buf = NULL;
+  lgr->fmt_tbl = NULL;
+  lgr->fmt_tbl_ids = NULL;
+  lgr->fmt_tbl_size = 0;
+  lgr->fmt_tbl_cnt = 0;
+
+  lgr->tsc_ref = 0;
+  lgr->usec_ref = 0;
+  lgr->tsc_per_usec = 0;
+  lgr->tsc_base = 0;
+  lgr->usec_base = 0;
+  lgr->tsc_next_cal = 0;
+
+  lgr->ts_sec = -1;
+  lgr->ts_prefix_len = 0;
+  lgr->ts_day_start = 0;
+  lgr->ts_day_end = 0;
+  lgr->ts_wday = 0;
 
   lgr->file_prefix_len = strlen(file_prefix);
   lgr->file_prefix = strdup(file_prefix);
   if (lgr->file_prefix == NULL) {
-    lgr_delete(lgr); return LGR_ERR_MALLOC;
+    lgr_free(lgr); return LGR_ERR_MALLOC;
   }
   /* Allow space for suffix "_xxx" and trailing NUL. */
   lgr->file_full_name = malloc(lgr->file_prefix_len + 5);
   if (lgr->file_full_name == NULL) {
-    lgr_delete(lgr); return LGR_ERR_MALLOC;
+    lgr_free(lgr); return LGR_ERR_MALLOC;
   }
   memset(lgr->file_full_name, '\0', lgr->file_prefix_len + 5);
 
-  /* Pool of available log objects. */
-  if (q_create(&(lgr->pool_q), q_size) != QERR_OK) {
-    lgr_delete(lgr); return LGR_ERR_MALLOC;
+  if (flags & LGR_FLAGS_MPMC) {
+    /* Lock-free multi-producer queues replace pool_q and log_q. */
+    if (qm_create(&(lgr->pool_qm), q_size) != QERR_OK) {
+      lgr_free(lgr); return LGR_ERR_MALLOC;
+    }
+    if (qm_create(&(lgr->log_qm), q_size) != QERR_OK) {
+      lgr_free(lgr); return LGR_ERR_MALLOC;
+    }
   }
-  /* Queue for outgoing logs. */
-  if (q_create(&(lgr->log_q), q_size) != QERR_OK) {
-    lgr_delete(lgr); return LGR_ERR_MALLOC;
+  else if (num_classes > 0) {
+    /* A pool per size class. */
+    for (i = 0; i < num_classes; i++) {
+      if (q_create(&(lgr->class_pool_q[i]), q_size) != QERR_OK) {
+        lgr_free(lgr); return LGR_ERR_MALLOC;
+      }
+    }
+  }
+  else {
+    /* Pool of available log objects. */
+    if (q_create(&(lgr->pool_q), q_size) != QERR_OK) {
+      lgr_free(lgr); return LGR_ERR_MALLOC;
+    }
+  }
+  if (! (flags & LGR_FLAGS_MPMC)) {
+    /* Queue for outgoing logs. */
+    if (q_create(&(lgr->log_q), q_size) != QERR_OK) {
+      lgr_free(lgr); return LGR_ERR_MALLOC;
+    }
   }
 
-  /* Create log objects and add them to the pool. But remember that the "q"
-   * can never be fuller than q_size - 1. Also, want to leave room for "quit"
-   * and "overflow" logs. So create 3 fewer than the queue size. */
-  for (i = 0; i < (q_size - 3); i++) {
-    /* Leave extra room in string buffer for NUL and truncate test. */
-    lgr_log_t *log = (lgr_log_t *)malloc(sizeof(lgr_log_t) + max_msg_size + 2);
-    if (log == NULL) { lgr_delete(lgr); return LGR_ERR_MALLOC; }
-
-    log->type = LGR_LOG_TYPE_MSG;
-    qerr = q_enq(lgr->pool_q, log);
-    CPRT_ASSERT(qerr == QERR_OK);
+  /* Create log objects in one arena and add them to the pool. But remember
+   * that the "q" can never be fuller than q_size - 1. Also, want to leave
+   * room for "quit" and "overflow" logs. So create 3 fewer than the queue
+   * size. With per-thread queues, each app thread gets its own pool instead,
+   * and with a byte ring, the ring replaces the pool. With pool_chunk_logs,
+   * the arena is allocated a chunk at a time. */
+  if (num_classes > 0) {
+    lgr_err_t err;
+    size_t arena_size = 0;
+    char *next;
+
+    /* Same arena, carved up by class. */
+    for (i = 0; i < num_classes; i++) {
+      arena_size += lgr_arena_size(attr->class_logs[i],
+          attr->class_msg_size[i]);
+    }
+    lgr->arena = lgr_arena_alloc(lgr, arena_size,
+        &(lgr->arena_size), &(lgr->arena_mapped), &err);
+    if (lgr->arena == NULL) { lgr_free(lgr); return err; }
+    next = lgr->arena;
+    for (i = 0; i < num_classes; i++) {
+      next = lgr_arena_fill(lgr, next, attr->class_logs[i],
+          attr->class_msg_size[i], lgr->class_pool_q[i]);
+    }
+  }
+  else if (lgr->pool_chunk_logs > 0) {
+    lgr_err_t err;
+    unsigned int max_chunks = (lgr->pool_max_logs + lgr->pool_chunk_logs - 1)
+        / lgr->pool_chunk_logs;
+
+    /* Start with one chunk; the logger thread adds the rest on demand. */
+    lgr->chunks = (lgr_chunk_t *)calloc(max_chunks, sizeof(lgr_chunk_t));
+    if (lgr->chunks == NULL) { lgr_free(lgr); return LGR_ERR_MALLOC; }
+    if (lgr->pool_shrink_ms > 0) {
+      lgr->pool_scratch = (lgr_log_t **)malloc(q_size * sizeof(lgr_log_t *));
+      if (lgr->pool_scratch == NULL) {
+        lgr_free(lgr); return LGR_ERR_MALLOC;
+      }
+    }
+    err = lgr_pool_grow(lgr);
+    if (err != LGR_ERR_OK) { lgr_free(lgr); return err; }
+  }
+  else if (! (flags & (LGR_FLAGS_PER_THREAD | LGR_FLAGS_BYTE_RING))) {
+    lgr_err_t err;
+
+    lgr->arena = lgr_arena_alloc(lgr,
+        lgr_arena_size(q_size - 3, max_msg_size),
+        &(lgr->arena_size), &(lgr->arena_mapped), &err);
+    if (lgr->arena == NULL) { lgr_free(lgr); return err; }
+    lgr_arena_fill(lgr, lgr->arena, q_size - 3, max_msg_size, lgr->pool_q);
   }
 
-  CPRT_THREAD_CREATE(lgr->thread_id, lgr_thread, lgr);
-  /* Wait for thread to finish initialization. */
-  while (lgr->state == LGR_STATE_INITIALIZING) {
-    CPRT_SLEEP_MS(1);
+  if (flags & LGR_FLAGS_DEFER_FMT) {
+    lgr->fmt_buf = (char *)malloc(max_msg_size + 2);
+    if (lgr->fmt_buf == NULL) { lgr_free(lgr); return LGR_ERR_MALLOC; }
   }
 
-  *rtn_lgr = lgr;
-  return LGR_ERR_OK;
-}  /* lgr_create */
+  if (flags & LGR_FLAGS_COALESCE) {
+    lgr->repeat_msg = (char *)malloc(max_msg_size + 1);
+    if (lgr->repeat_msg == NULL) { lgr_free(lgr); return LGR_ERR_MALLOC; }
+  }
 
+  if (flags & LGR_FLAGS_BINARY) {
+    lgr->fmt_tbl_size = 256;  /* Grows as needed. */
+    lgr->fmt_tbl = (const char **)calloc(lgr->fmt_tbl_size,
+        sizeof(const char *));
+    lgr->fmt_tbl_ids = (uint32_t *)malloc(lgr->fmt_tbl_size *
+        sizeof(uint32_t));
+    if (lgr->fmt_tbl == NULL || lgr->fmt_tbl_ids == NULL) {
+      lgr_free(lgr); return LGR_ERR_MALLOC;
+    }
+  }
 
-lgr_err_t lgr_delete(lgr_t *lgr)
-{
-  qerr_t qerr;
+  /* Page aligned, for the benefit of the file system. */
+  for (i = 0; i < 2; i++) {
+    if (posix_memalign((void **)&(lgr->out_bufs[i]), 4096,
+        lgr->out_buf_size) != 0) {
+      lgr->out_bufs[i] = NULL;
+      lgr_free(lgr); return LGR_ERR_MALLOC;
+    }
+    if (lgr->numa_node >= 0 && cprt_try_numa_bind(lgr->out_bufs[i],
+        lgr->out_buf_size, lgr->numa_node) != 0) {
+      lgr_free(lgr); return LGR_ERR_NUMA;
+    }
+  }
 
-  if (lgr->state != LGR_STATE_RUNNING) {
-    return LGR_ERR_EXITING;
+  if (flags & LGR_FLAGS_IO_URING) {
+    /* Only 2 writes are ever in flight. */
+    if (lgr_uring_create(&(lgr->uring), 4) != 0) {
+      /* Not available; write synchronously. */
+      lgr->uring = NULL;
+      lgr->flags &= ~LGR_FLAGS_IO_URING;
+    }
+  }
+
+  if (flags & LGR_FLAGS_BYTE_RING) {
+    lgr_err_t err;
+
+    /* The ring is the arena. (Page aligned, so LGR_RING_ALIGN too.) */
+    lgr->ring_buf = lgr_arena_alloc(lgr, ring_size, &(lgr->arena_size),
+        &(lgr->arena_mapped), &err);
+    if (lgr->ring_buf == NULL) { lgr_free(lgr); return err; }
+  }
+
+  if (flags & LGR_FLAGS_TSC_TS) {
+    /* Initial TSC rate. Refined by the logger thread as time goes on. */
+    lgr_tsc_sample(&(lgr->tsc_base), &(lgr->usec_base));
+    CPRT_SLEEP_MS(10);
+    lgr_tsc_sample(&(lgr->tsc_ref), &(lgr->usec_ref));
+    if (lgr->usec_ref > lgr->usec_base && lgr->tsc_ref > lgr->tsc_base) {
+      lgr->tsc_per_usec = (double)(lgr->tsc_ref - lgr->tsc_base) /
+          (double)(lgr->usec_ref - lgr->usec_base);
+      lgr->tsc_next_cal = lgr->tsc_ref + (uint64_t)(lgr->tsc_per_usec * 1000000);
+    }
+    else {  /* Clock didn't move forward; can't calibrate. */
+      lgr->flags &= ~LGR_FLAGS_TSC_TS;
+    }
+  }
+
+  CPRT_THREAD_CREATE(lgr->thread_id, lgr_thread, lgr);
+  /* Wait for thread to finish initialization. */
+  while (lgr->state == LGR_STATE_INITIALIZING) {
+    CPRT_SLEEP_MS(1);
+  }
+  if (lgr->thread_err != LGR_ERR_OK) {
+    lgr_err_t err = lgr->thread_err;
+
+    CPRT_THREAD_JOIN(lgr->thread_id);  /* Has already returned. */
+    lgr_free(lgr);
+    return err;
+  }
+
+  *rtn_lgr = lgr;
+  return LGR_ERR_OK;
+}  /* lgr_create */
+
+
+lgr_err_t lgr_delete(lgr_t *lgr)
+{
+  qerr_t qerr;
+
+  if (lgr->state != LGR_STATE_RUNNING) {
+    return LGR_ERR_EXITING;
   }
 
   lgr->state = LGR_STATE_EXITING;
-  qerr = q_enq(lgr->log_q, (void *)&(lgr->quit_log));
+  qerr = lgr_enq_log(lgr, lgr->log_q, &(lgr->quit_log));
   CPRT_ASSERT(qerr == QERR_OK);  /* The q_enq should always succeed. */
+  if (lgr->flags & LGR_FLAGS_WAKEUP) {
+    lgr_wake(lgr);
+  }
   CPRT_THREAD_JOIN(lgr->thread_id);  /* Wait for thread to exit. */
 
-  if (lgr->log_q != NULL) {
-    lgr_log_t *log;
-    /* By now there should be no remaining entries in the log q.
-     * But just in case, minimize memory leaks. */
-    while (q_deq(lgr->log_q, (void **)&log) == QERR_OK) {
-      if (log->type == LGR_LOG_TYPE_MSG) {
-        free(log);
+  /* Let call sites register with a future lgr. */
+  CPRT_SPIN_LOCK(lgr->site_lock);
+  while (lgr->sites != NULL) {
+    lgr_site_t *site = lgr->sites;
+    lgr->sites = site->next;
+    site->next = NULL;
+    site->lgr = NULL;
+  }
+  CPRT_SPIN_UNLOCK(lgr->site_lock);
+
+  lgr_free(lgr);
+
+  return LGR_ERR_OK;
+}  /* lgr_delete */
+
+
+/* Called by lgr_log() when an overflow happens. */
+void lgr_enqueue_overflow(lgr_t *lgr, unsigned int severity)
+{
+  qerr_t qerr;
+
+  CPRT_ASSERT(severity >= 0 && severity <= LGR_LAST_SEV);
+
+  CPRT_SPIN_LOCK(lgr->overflow_lock);
+
+  lgr->overflows[severity] ++;
+  lgr->overflows_total[severity] ++;
+
+  if (lgr->overflow_log_available) {
+    lgr->overflow_log_available = 0;
+    CPRT_TIMEOFDAY(&(lgr->overflow_log.tv), NULL);
+    qerr = lgr_enq_log(lgr, lgr->log_q, &(lgr->overflow_log));
+    CPRT_ASSERT(qerr == QERR_OK);  /* The q_enq should always succeed. */
+  }
+
+  CPRT_SPIN_UNLOCK(lgr->overflow_lock);
+
+  if (lgr->flags & LGR_FLAGS_WAKEUP) {
+    lgr_wake(lgr);
+  }
+}  /* lgr_enqueue_overflow */
+
+
+/* Called by lgr_log() (with log_lock held) to reserve room for a max-sized
+ * log in the byte ring. Returns NULL if the ring is full, or if taking it
+ * would leave fewer than "reserve" max-sized logs free (see sev_reserve).
+ * The reservation is trimmed to the actual message length by
+ * lgr_ring_commit(). */
+lgr_log_t *lgr_ring_reserve(lgr_t *lgr, unsigned int reserve)
+{
+  uint64_t start = lgr->ring_tail;
+  uint64_t pos = start & (lgr->ring_size - 1);
+
+  /* Limit logs in flight to what log_q can hold (see lgr_create_attr()). */
+  if (lgr->ring_resv_cnt - lgr->ring_rel_cnt + reserve >= lgr->q_size - 3) {
+    return NULL;
+  }
+
+  /* Logs must be contiguous. If this one won't fit before the end of the
+   * buffer, skip the remainder; lgr_ring_release() skips it too. */
+  if (lgr->ring_size - pos < lgr->ring_rec_max) {
+    start += lgr->ring_size - pos;
+    pos = 0;
+  }
+  if (start + (uint64_t)(reserve + 1) * lgr->ring_rec_max - lgr->ring_head
+      > lgr->ring_size) {
+    return NULL;
+  }
+
+  lgr->ring_tail = start;
+  return (lgr_log_t *)&(lgr->ring_buf[pos]);
+}  /* lgr_ring_reserve */
+
+
+/* Called by lgr_log() after the message is formatted (or packed).
+ * "msg_bytes" is the number of bytes used in log->msg. */
+void lgr_ring_commit(lgr_t *lgr, lgr_log_t *log, unsigned int msg_bytes)
+{
+  uint64_t used;
+
+  /* The msg buffer is never more than max_msg_size + 2. */
+  if (msg_bytes > lgr->max_msg_size + 2) {
+    msg_bytes = lgr->max_msg_size + 2;
+  }
+  used = LGR_RING_ROUND(offsetof(lgr_log_t, msg) + msg_bytes);
+
+  log->type = LGR_LOG_TYPE_MSG;
+  log->pool_q = NULL;
+  log->rec_size = (unsigned int)used;
+  lgr->ring_tail += used;
+  lgr->ring_resv_cnt++;
+}  /* lgr_ring_commit */
+
+
+/* Called by logger thread when done with a byte ring log. Logs are
+ * released in the order they were reserved. */
+void lgr_ring_release(lgr_t *lgr, lgr_log_t *log)
+{
+  uint64_t head = lgr->ring_head;
+  uint64_t pos = (uint8_t *)log - lgr->ring_buf;
+  /* Distance from head to this log; non-zero if a wrap gap was skipped. */
+  uint64_t skip = (pos - head) & (lgr->ring_size - 1);
+
+  CPRT_MEM_BARRIER;  /* Finish reading the log before freeing its space. */
+  lgr->ring_head = head + skip + log->rec_size;
+  lgr->ring_rel_cnt++;
+}  /* lgr_ring_release */
+
+
+/* Size class of a log, from its buffer size. */
+static int lgr_class_of(lgr_t *lgr, lgr_log_t *log)
+{
+  unsigned int msg_size = log->rec_size - sizeof(lgr_log_t) - 2;
+  int c;
+
+  for (c = 0; c < lgr->num_classes - 1; c++) {
+    if (lgr->class_msg_size[c] == msg_size) {
+      break;
+    }
+  }
+  return c;
+}  /* lgr_class_of */
+
+
+/* Take a log of size class "c": its spare if it has one, otherwise one from
+ * its pool. The spare counts as one of the class's free logs for
+ * sev_reserve. */
+static lgr_log_t *lgr_class_take(lgr_t *lgr, int c, unsigned int severity)
+{
+  q_t *pool_q = lgr->class_pool_q[c];
+  unsigned int reserve = lgr->sev_reserve[severity];
+  lgr_log_t *log;
+
+  if (reserve > 0 && q_count(pool_q) + (lgr->class_spare[c] != NULL)
+      <= reserve) {
+    return NULL;
+  }
+  if (lgr->class_spare[c] != NULL) {
+    log = lgr->class_spare[c];
+    lgr->class_spare[c] = NULL;
+    return log;
+  }
+  if (q_deq(pool_q, (void **)&log) != QERR_OK) {
+    return NULL;
+  }
+  return log;
+}  /* lgr_class_take */
+
+
+/* Called by lgr_log() (with log_lock held, if any) to take a free log for
+ * a message of the given severity. Returns NULL if none is available, or if
+ * taking one would dip into the logs reserved for higher severities. */
+static lgr_log_t *lgr_take_log(lgr_t *lgr, q_t *pool_q, unsigned int severity)
+{
+  unsigned int reserve = lgr->sev_reserve[severity];
+  lgr_log_t *log;
+
+  if (lgr->num_classes > 0) {
+    /* Smallest class first; lgr_class_fit() moves up if needed. */
+    int c;
+    for (c = 0; c < lgr->num_classes; c++) {
+      log = lgr_class_take(lgr, c, severity);
+      if (log != NULL) {
+        return log;
       }
     }
-    q_delete(lgr->log_q);
-    lgr->log_q = NULL;
+    return NULL;
+  }
+  if (lgr->flags & LGR_FLAGS_BYTE_RING) {
+    return lgr_ring_reserve(lgr, reserve);
   }
+  if (lgr->flags & LGR_FLAGS_MPMC) {
+    if (reserve > 0 && qm_count(lgr->pool_qm) <= reserve) {
+      return NULL;
+    }
+    if (qm_deq(lgr->pool_qm, (void **)&log) != QERR_OK) {
+      return NULL;
+    }
+    return log;
+  }
+  if (reserve > 0 && q_count(pool_q) <= reserve) {
+    return NULL;
+  }
+  if (q_deq(pool_q, (void **)&log) != QERR_OK) {
+    return NULL;
+  }
+  return log;
+}  /* lgr_take_log */
+
+
+/* Size classes: "log"'s message format and args didn't fit in its class.
+ * Format into a log of the smallest class that the message fits in (or
+ * the largest class, which truncates as usual). The unused log is kept as
+ * its class's spare. Returns the log with its message, setting *rtn_msg_len
+ * (-1 if still to be formatted), or NULL if no big enough log is free
+ * (overflow). Called with log_lock held (if locking). */
+static lgr_log_t *lgr_class_fit(lgr_t *lgr, lgr_log_t *log,
+    unsigned int severity, char *fmt, va_list in_args, int *rtn_msg_len)
+{
+  lgr_log_t *new_log = NULL;
+  va_list args;
+  int c, len;
 
-  if (lgr->pool_q != NULL) {
-    lgr_log_t *log;
-    while (q_deq(lgr->pool_q, (void **)&log) == QERR_OK) {
-      free(log);
+  c = lgr_class_of(lgr, log);
+  if (c == lgr->num_classes - 1) {
+    *rtn_msg_len = -1;  /* Largest class; caller formats as usual. */
+    return log;
+  }
+
+  va_copy(args, in_args);
+  len = vsnprintf(log->msg, lgr->class_msg_size[c] + 1, fmt, args);
+  va_end(args);
+  if (len >= 0 && (unsigned int)len <= lgr->class_msg_size[c]) {
+    *rtn_msg_len = len + 1;  /* Include NUL. */
+    return log;
+  }
+
+  /* Doesn't fit. lgr_class_take() emptied this class's spare slot. */
+  lgr->class_spare[c] = log;
+  for (c++; c < lgr->num_classes; c++) {
+    if ((len < 0 || (unsigned int)len > lgr->class_msg_size[c])
+        && c < lgr->num_classes - 1) {
+      continue;  /* Too small too. */
+    }
+    new_log = lgr_class_take(lgr, c, severity);
+    if (new_log != NULL) {
+      break;
     }
-    q_delete(lgr->pool_q);
-    lgr->pool_q = NULL;
   }
+  if (new_log == NULL) {
+    return NULL;
+  }
+  new_log->tv = log->tv;
+  new_log->tsc = log->tsc;
+  new_log->severity = log->severity;
+  new_log->fmt = NULL;
+
+  *rtn_msg_len = -1;
+  if (c < lgr->num_classes - 1) {
+    va_copy(args, in_args);
+    (void)vsnprintf(new_log->msg, lgr->class_msg_size[c] + 1, fmt, args);
+    va_end(args);
+    *rtn_msg_len = len + 1;
+  }
+  return new_log;
+}  /* lgr_class_fit */
+
+
+/* Wait step for an lgr_log() that is blocked because no log is free (see
+ * lgr_attr_t.block_us). Spins for the first LGR_BLOCK_SPIN_US, then parks
+ * until the logger thread frees a log (at most 1 ms at a time, in case the
+ * wakeup is missed). The first step after spinning only registers the caller
+ * in block_waiters and reads free_seq, so that the caller retries the pool
+ * before it parks; the caller decrements block_waiters when *parked is set.
+ * Returns 0 when the deadline has passed. */
+static int lgr_block_wait(lgr_t *lgr, struct cprt_timespec *start_ts,
+    unsigned int block_us, int *parked, int *seq)
+{
+  struct cprt_timespec cur_ts;
+  uint64_t waited_ns;
 
-  if (lgr->file_full_name != NULL) {
-    free(lgr->file_full_name);
-    lgr->file_full_name = NULL;
+  CPRT_GETTIME(&cur_ts);
+  CPRT_DIFF_TS(waited_ns, cur_ts, (*start_ts));
+  if (waited_ns >= (uint64_t)block_us * 1000) {
+    return 0;
   }
-  if (lgr->file_prefix != NULL) {
-    free(lgr->file_prefix);
-    lgr->file_prefix = NULL;
+  if (waited_ns < LGR_BLOCK_SPIN_US * 1000) {
+    CPRT_CPU_PAUSE();
+    return 1;
   }
 
-  if (! (lgr->flags & LGR_FLAGS_NOLOCK)) {
-    CPRT_SPIN_DELETE(lgr->log_lock);
+  if (*parked) {
+    cprt_futex_wait(&(lgr->free_seq), *seq, 1);
   }
-  CPRT_SPIN_DELETE(lgr->overflow_lock);
+  else {
+    /* Full barrier; pairs with the one in lgr_free_logs(). Either the
+     * logger sees this waiter and bumps free_seq, or the caller's retry
+     * sees the refilled pool. */
+    CPRT_ATOMIC_INC_VAL(&(lgr->block_waiters));
+    *parked = 1;
+  }
+  *seq = lgr->free_seq;
+  CPRT_MEM_BARRIER;  /* Read free_seq before retrying the pool. */
 
-  free(lgr);
+  return 1;
+}  /* lgr_block_wait */
+
+
+lgr_err_t lgr_log(lgr_t *lgr, unsigned int severity, char *fmt, ...)
+{
+  lgr_err_t err;
+  va_list args;
+
+  va_start(args, fmt);
+  err = lgr_vlog(lgr, lgr->block_us, severity, fmt, args);
+  va_end(args);
+
+  return err;
+}  /* lgr_log */
+
+
+lgr_err_t lgr_log_block(lgr_t *lgr, unsigned int block_us,
+    unsigned int severity, char *fmt, ...)
+{
+  lgr_err_t err;
+  va_list args;
+
+  va_start(args, fmt);
+  err = lgr_vlog(lgr, block_us, severity, fmt, args);
+  va_end(args);
+
+  return err;
+}  /* lgr_log_block */
+
+
+lgr_err_t lgr_vlog(lgr_t *lgr, unsigned int block_us, unsigned int severity,
+    char *fmt, va_list in_args)
+{
+  lgr_log_t *log;
+  qerr_t qerr;
+  va_list args;
+  q_t *pool_q;
+  q_t *log_q;
+  int locking;
+  int msg_len = -1;
+  uint64_t start_stamp = 0;
+
+  if (severity < 0 || severity > LGR_LAST_SEV) {
+    return LGR_ERR_SEVERITY;
+  }
+  if (severity < lgr->min_sev) {
+    return LGR_ERR_OK;  /* Filtered out; not an error. */
+  }
+  if (lgr->state != LGR_STATE_RUNNING) {
+    return LGR_ERR_EXITING;
+  }
+  if (lgr->flags & LGR_FLAGS_STATS) {
+    start_stamp = lgr_stamp(lgr);
+  }
+
+  if (lgr->flags & LGR_FLAGS_PER_THREAD) {
+    /* Each app thread owns its queues; no lock needed. */
+    lgr_thread_t *thr = (lgr_thread_t *)CPRT_TLS_GET(lgr->thread_key);
+    if (thr == NULL) {
+      lgr_err_t err = lgr_thread_register(lgr, &thr);
+      if (err != LGR_ERR_OK) { return err; }
+    }
+    pool_q = thr->pool_q;
+    log_q = thr->log_q;
+    locking = 0;
+  }
+  else {
+    pool_q = lgr->pool_q;
+    log_q = lgr->log_q;
+    locking = ! (lgr->flags & (LGR_FLAGS_NOLOCK | LGR_FLAGS_MPMC));
+  }
+
+  if (locking) {
+    CPRT_SPIN_LOCK(lgr->log_lock);
+  }
+
+  log = lgr_take_log(lgr, pool_q, severity);
+  qerr = (log == NULL) ? QERR_EMPTY : QERR_OK;
+  if (qerr == QERR_EMPTY && block_us > 0) {
+    /* Wait for the logger thread to free a log. */
+    struct cprt_timespec start_ts, end_ts;
+    uint64_t blocked_ns;
+
+    int parked = 0;
+    int seq = 0;
+
+    CPRT_GETTIME(&start_ts);
+    while (qerr == QERR_EMPTY && lgr->state == LGR_STATE_RUNNING) {
+      int waiting;
+
+      if (locking) {
+        CPRT_SPIN_UNLOCK(lgr->log_lock);
+      }
+      waiting = lgr_block_wait(lgr, &start_ts, block_us, &parked, &seq);
+      if (locking) {
+        CPRT_SPIN_LOCK(lgr->log_lock);
+      }
+      if (! waiting) {
+        break;
+      }
+      log = lgr_take_log(lgr, pool_q, severity);
+      qerr = (log == NULL) ? QERR_EMPTY : QERR_OK;
+    }
+    if (parked) {
+      CPRT_ATOMIC_DEC_VAL(&(lgr->block_waiters));
+    }
+    CPRT_GETTIME(&end_ts);
+    CPRT_DIFF_TS(blocked_ns, end_ts, start_ts);
+    CPRT_ATOMIC_ADD_VAL(&(lgr->blocked_logs), 1);
+    CPRT_ATOMIC_ADD_VAL(&(lgr->blocked_ns), blocked_ns);
+    if (qerr == QERR_EMPTY) {
+      if (lgr->state != LGR_STATE_RUNNING) {
+        if (locking) {
+          CPRT_SPIN_UNLOCK(lgr->log_lock);
+        }
+        return LGR_ERR_EXITING;
+      }
+      CPRT_ATOMIC_ADD_VAL(&(lgr->blocked_timeouts), 1);
+    }
+  }
+  if (qerr == QERR_EMPTY) {
+    lgr_enqueue_overflow(lgr, severity);
+    if (locking) {
+      CPRT_SPIN_UNLOCK(lgr->log_lock);
+    }
+    return LGR_ERR_QFULL;  /* No free logs means the logger is full. */
+  }
+  CPRT_ASSERT(qerr == QERR_OK);
+
+  /* If user specified LGR_FLAGS_DEFER_TS, take timestamp in logger thread.
+   * If not, then take timestamp now. */
+  if (lgr->flags & LGR_FLAGS_TSC_TS) {
+    log->tsc = CPRT_RDTSC();  /* Logger thread converts to wall clock. */
+  }
+  else if (! (lgr->flags & LGR_FLAGS_DEFER_TS)) {
+    /* LGR_FLAGS_DEFER_TS not specified, take timestamp here. */
+    CPRT_TIMEOFDAY(&(log->tv), NULL);
+  }
+  log->severity = severity;
+
+  log->fmt = NULL;
+  if (lgr->flags & LGR_FLAGS_DEFER_FMT) {
+    /* Save the args; the logger thread formats them. Strings are copied,
+     * but only as much as could appear in a max-sized message. */
+    unsigned int buf_size = lgr->max_msg_size + 2;
+
+    if (lgr->num_classes > 0) {  /* Pack into this log's class. */
+      buf_size = log->rec_size - sizeof(lgr_log_t);
+    }
+    va_copy(args, in_args);
+    msg_len = lgr_fmt_pack(log->msg, buf_size, fmt, args,
+        lgr->max_msg_size + 1);
+    va_end(args);
+    if (msg_len >= 0) {
+      log->fmt = fmt;
+      log->msg_len = msg_len;
+    }
+  }
+
+  if (log->fmt == NULL && lgr->num_classes > 0) {
+    log = lgr_class_fit(lgr, log, severity, fmt, in_args, &msg_len);
+    if (log == NULL) {
+      lgr_enqueue_overflow(lgr, severity);
+      if (locking) {
+        CPRT_SPIN_UNLOCK(lgr->log_lock);
+      }
+      return LGR_ERR_QFULL;  /* No log big enough. */
+    }
+  }
+
+  if (log->fmt == NULL && msg_len < 0) {
+    /* Truncate test: preset the NUL for the max allowable message.
+     * Then do the sprintf into the full buffer (2 larger max message).
+     * Then the logger thread checks the NUL for the max allowable message. */
+    log->msg[lgr->max_msg_size] = '\0';
+
+    va_copy(args, in_args);
+    /* Leave room for NUL and truncate test. */
+    msg_len = vsnprintf(log->msg, lgr->max_msg_size + 2, fmt, args);
+    va_end(args);
+    if (msg_len < 0 || msg_len > lgr->max_msg_size + 1) {
+      msg_len = lgr->max_msg_size + 1;
+    }
+    msg_len++;  /* Include NUL. */
+  }
+
+  if (lgr->flags & LGR_FLAGS_BYTE_RING) {
+    lgr_ring_commit(lgr, log, msg_len);
+  }
+
+  if (lgr->flags & LGR_FLAGS_STATS) {
+    /* Carried to the logger thread, which owns the histograms. */
+    uint64_t end_stamp = lgr_stamp(lgr);
+    uint64_t cost = end_stamp - start_stamp;
+
+    log->call_cost = (cost > UINT32_MAX) ? UINT32_MAX : (uint32_t)cost;
+    log->tsc = end_stamp;  /* Same units as "cost" (see lgr_stamp()). */
+  }
+
+  /* The log queue should always have room. */
+  CPRT_ASSERT(lgr_enq_log(lgr, log_q, log) == QERR_OK);
+
+  if (locking) {
+    CPRT_SPIN_UNLOCK(lgr->log_lock);
+  }
+
+  if (lgr->flags & LGR_FLAGS_WAKEUP) {
+    lgr_wake(lgr);
+  }
 
   return LGR_ERR_OK;
-}  /* lgr_delete */
+}  /* lgr_vlog */
+
+
+/* Change the minimum severity at run time. Takes effect for other threads
+ * as soon as they see the store; no lock is needed. */
+lgr_err_t lgr_set_min_sev(lgr_t *lgr, lgr_sev_t min_sev)
+{
+  if (min_sev > LGR_LAST_SEV) {
+    return LGR_ERR_SEVERITY;
+  }
+  lgr->min_sev = min_sev;
+
+  return LGR_ERR_OK;
+}  /* lgr_set_min_sev */
+
+
+/* Copy the statistics into "stats". Can be called from any thread at any
+ * time; the counters are read without locking, so the snapshot is not
+ * atomic (e.g. a histogram's cnt may be one ahead of its buckets). */
+lgr_err_t lgr_get_stats(lgr_t *lgr, lgr_stats_t *stats)
+{
+  int i;
+
+  stats->logs = lgr->logs_total;
+  for (i = 0; i <= LGR_LAST_SEV; i++) {
+    stats->overflows[i] = lgr->overflows_total[i];
+    stats->file_size_drops[i] = lgr->file_size_drops_total[i];
+  }
+  stats->suppressed = lgr->suppressed_total;
+  stats->blocked_logs = lgr->blocked_logs;
+  stats->blocked_ns = lgr->blocked_ns;
+  stats->blocked_timeouts = lgr->blocked_timeouts;
+  stats->pool_logs = lgr->pool_chunk_logs ? lgr->pool_logs
+      : lgr->q_size - 3;
+  stats->coalesced = lgr->repeat_total;
+  stats->pool_grows = lgr->pool_grows;
+  stats->pool_shrinks = lgr->pool_shrinks;
+  stats->log_q_hwm = lgr->log_q_hwm;
+  stats->call_ns = lgr->call_hist;
+  stats->queue_ns = lgr->queue_hist;
+  stats->write_ns = lgr->write_hist;
+
+  return LGR_ERR_OK;
+}  /* lgr_get_stats */
+
+
+/* Called by LGR_LOG_RATELIMITED() and LGR_LOG_SAMPLED() the first time a
+ * call site is used with "lgr". A site should only be used with one lgr at
+ * a time. */
+void lgr_site_register(lgr_t *lgr, lgr_site_t *site, lgr_sev_t severity,
+    unsigned int per_sec, unsigned int sample_n, const char *file, int line)
+{
+  CPRT_SPIN_LOCK(lgr->site_lock);
+  if (site->lgr != lgr) {
+    site->cnt = 0;
+    site->per_sec = per_sec;
+    site->sample_n = (per_sec == 0 && sample_n == 0) ? 1 : sample_n;
+    site->severity = severity;
+    site->file = file;
+    site->line = line;
+    site->next = lgr->sites;
+    lgr->sites = site;
+    CPRT_MEM_BARRIER;  /* Fields must be visible before "lgr" is. */
+    site->lgr = lgr;
+  }
+  CPRT_SPIN_UNLOCK(lgr->site_lock);
+}  /* lgr_site_register */
+
+
+static char *wday2str[7] = {
+  "sun", "mon", "tue", "wed", "thu", "fri", "sat"
+};
+
+
+/* Output engine. Records are formatted straight into the current output
+ * buffer, which is written with a single write when it fills up or when
+ * the log queues drain (lgr_out_flush()). There are two buffers so that one
+ * can be filled while the other is being written. With LGR_FLAGS_IO_URING,
+ * that write is asynchronous. */
+
+/* Write "iov" to the output file, retrying partial writes. */
+static void lgr_out_writev(lgr_t *lgr, struct iovec *iov, int iov_cnt)
+{
+  while (iov_cnt > 0) {
+    ssize_t n = pwritev(lgr->cur_out_fd, iov, iov_cnt, lgr->out_file_off);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      CPRT_PERRNO("ERROR: lgr: pwritev failed");
+      return;
+    }
+    lgr->out_file_off += n;
+    /* Skip past what was written. */
+    while (iov_cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iov_cnt--;
+    }
+    if (iov_cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}  /* lgr_out_writev */
+
+
+/* Wait for asynchronous writes (LGR_FLAGS_IO_URING) until output buffer
+ * "buf_idx" is free, or until both are if "buf_idx" is -1. */
+static void lgr_out_wait(lgr_t *lgr, int buf_idx)
+{
+  while ((buf_idx == -1)
+      ? (lgr->out_inflight[0] > 0 || lgr->out_inflight[1] > 0)
+      : (lgr->out_inflight[buf_idx] > 0)) {
+    int res;
+    uint64_t done_idx;
+    ssize_t n;
+
+    if (lgr_uring_reap(lgr->uring, 1, &res, &done_idx) < 0) {
+      CPRT_PERRNO("ERROR: lgr: io_uring wait failed");
+      lgr->out_inflight[0] = 0;
+      lgr->out_inflight[1] = 0;
+      return;
+    }
+    if (res < 0) {
+      errno = -res;
+      CPRT_PERRNO("ERROR: lgr: io_uring write failed");
+    }
+    else if ((size_t)res < lgr->out_inflight[done_idx]) {
+      /* Short write; finish it synchronously. */
+      char *buf = lgr->out_bufs[done_idx] + res;
+      size_t len = lgr->out_inflight[done_idx] - res;
+      uint64_t off = lgr->out_inflight_off[done_idx] + res;
+      while (len > 0) {
+        n = pwrite(lgr->cur_out_fd, buf, len, off);
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          CPRT_PERRNO("ERROR: lgr: pwrite failed");
+          break;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+      }
+    }
+    lgr->out_inflight[done_idx] = 0;
+  }
+}  /* lgr_out_wait */
+
+
+/* Write the buffered output to the file and switch buffers. */
+static void lgr_out_flush(lgr_t *lgr)
+{
+  if (lgr->out_len > 0) {
+    int buf_idx = lgr->out_buf_idx;
+    struct iovec iov;
+    uint64_t start_stamp = 0;
+
+    if (lgr->flags & LGR_FLAGS_STATS) {
+      start_stamp = lgr_stamp(lgr);
+    }
+
+    if (lgr->uring != NULL) {
+      if (lgr_uring_write(lgr->uring, lgr->cur_out_fd, lgr->out_bufs[buf_idx],
+          lgr->out_len, lgr->out_file_off, buf_idx) == 0) {
+        lgr->out_inflight[buf_idx] = lgr->out_len;
+        lgr->out_inflight_off[buf_idx] = lgr->out_file_off;
+        lgr->out_file_off += lgr->out_len;
+        lgr->out_buf_idx ^= 1;
+        lgr->out_len = 0;
+        /* The next buffer's previous write must be finished before it is
+         * filled. */
+        lgr_out_wait(lgr, lgr->out_buf_idx);
+        if (lgr->flags & LGR_FLAGS_STATS) {
+          lgr_hist_add(&(lgr->write_hist),
+              lgr_stamp_ns(lgr, lgr_stamp(lgr) - start_stamp));
+        }
+        return;
+      }
+      CPRT_PERRNO("ERROR: lgr: io_uring submit failed");
+      lgr_out_wait(lgr, -1);  /* Keep the file in order. */
+    }
+
+    iov.iov_base = lgr->out_bufs[buf_idx];
+    iov.iov_len = lgr->out_len;
+    lgr_out_writev(lgr, &iov, 1);
+    lgr->out_buf_idx ^= 1;
+    lgr->out_len = 0;
+    if (lgr->flags & LGR_FLAGS_STATS) {
+      lgr_hist_add(&(lgr->write_hist),
+          lgr_stamp_ns(lgr, lgr_stamp(lgr) - start_stamp));
+    }
+  }
+}  /* lgr_out_flush */
+
+
+/* Map the window of the output file containing out_file_off
+ * (LGR_FLAGS_MMAP), growing the file if needed. Returns 0 on success. */
+static int lgr_mmap_move(lgr_t *lgr)
+{
+  uint64_t win_off = lgr->out_file_off & ~(uint64_t)(LGR_MMAP_WINDOW - 1);
+  void *win;
+
+  if (lgr->mmap_win != NULL) {
+    munmap(lgr->mmap_win, LGR_MMAP_WINDOW);
+    lgr->mmap_win = NULL;
+  }
+
+  if (win_off + LGR_MMAP_WINDOW > lgr->mmap_alloc_size) {
+    /* Past max_file_size_bytes; grow by a window. */
+    uint64_t new_size = win_off + LGR_MMAP_WINDOW;
+    if (posix_fallocate(lgr->cur_out_fd, lgr->mmap_alloc_size,
+        new_size - lgr->mmap_alloc_size) != 0
+        && ftruncate(lgr->cur_out_fd, new_size) != 0) {
+      CPRT_PERRNO("ERROR: lgr: ftruncate failed");
+      return -1;
+    }
+    lgr->mmap_alloc_size = new_size;
+  }
+
+  win = mmap(NULL, LGR_MMAP_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED,
+      lgr->cur_out_fd, win_off);
+  if (win == MAP_FAILED) {
+    CPRT_PERRNO("ERROR: lgr: mmap failed");
+    return -1;
+  }
+  lgr->mmap_win = (char *)win;
+  lgr->mmap_win_off = win_off;
+
+  return 0;
+}  /* lgr_mmap_move */
+
+
+/* Copy "iov" into the mapped file (LGR_FLAGS_MMAP) at out_file_off. On
+ * failure, returns -1 with "iov" advanced past what was copied. */
+static int lgr_mmap_copy(lgr_t *lgr, struct iovec *iov)
+{
+  while (iov->iov_len > 0) {
+    size_t win_pos, n;
+
+    if (lgr->mmap_win == NULL
+        || lgr->out_file_off >= lgr->mmap_win_off + LGR_MMAP_WINDOW) {
+      if (lgr_mmap_move(lgr) != 0) {
+        return -1;
+      }
+    }
+    win_pos = lgr->out_file_off - lgr->mmap_win_off;
+    n = LGR_MMAP_WINDOW - win_pos;
+    if (n > iov->iov_len) {
+      n = iov->iov_len;
+    }
+    memcpy(lgr->mmap_win + win_pos, iov->iov_base, n);
+    iov->iov_base = (char *)iov->iov_base + n;
+    iov->iov_len -= n;
+    lgr->out_file_off += n;
+  }
+
+  return 0;
+}  /* lgr_mmap_copy */
+
+
+/* Output one record, made up of "iov_cnt" pieces. A record that is larger
+ * than the buffer is written directly from the pieces, along with whatever
+ * is already buffered, in a single writev(). */
+#define LGR_OUT_MAX_PIECES 4
+static void lgr_out_pieces(lgr_t *lgr, struct iovec *iov, int iov_cnt)
+{
+  size_t total = 0;
+  int i;
+
+  if (lgr->out_mmap) {
+    for (i = 0; i < iov_cnt; i++) {
+      if (lgr_mmap_copy(lgr, &iov[i]) != 0) {
+        /* Can't map; write the rest of this file instead. */
+        lgr->out_mmap = 0;
+        iov += i;
+        iov_cnt -= i;
+        break;
+      }
+    }
+    if (lgr->out_mmap) {
+      return;
+    }
+  }
+
+  for (i = 0; i < iov_cnt; i++) {
+    total += iov[i].iov_len;
+  }
+
+  if (total <= lgr->out_buf_size) {
+    char *out;
+
+    if (lgr->out_len + total > lgr->out_buf_size) {
+      lgr_out_flush(lgr);
+    }
+    out = &(lgr->out_bufs[lgr->out_buf_idx][lgr->out_len]);
+    for (i = 0; i < iov_cnt; i++) {
+      memcpy(out, iov[i].iov_base, iov[i].iov_len);
+      out += iov[i].iov_len;
+    }
+    lgr->out_len += total;
+  }
+  else {
+    struct iovec all_iov[LGR_OUT_MAX_PIECES + 1];
+    int all_cnt = 0;
+
+    CPRT_ASSERT(iov_cnt <= LGR_OUT_MAX_PIECES);
+    if (lgr->uring != NULL) {
+      lgr_out_wait(lgr, -1);  /* Keep the file in order. */
+    }
+    if (lgr->out_len > 0) {
+      all_iov[all_cnt].iov_base = lgr->out_bufs[lgr->out_buf_idx];
+      all_iov[all_cnt].iov_len = lgr->out_len;
+      all_cnt++;
+    }
+    for (i = 0; i < iov_cnt; i++) {
+      all_iov[all_cnt++] = iov[i];
+    }
+    if (lgr->flags & LGR_FLAGS_STATS) {
+      uint64_t start_stamp = lgr_stamp(lgr);
+      lgr_out_writev(lgr, all_iov, all_cnt);
+      lgr_hist_add(&(lgr->write_hist),
+          lgr_stamp_ns(lgr, lgr_stamp(lgr) - start_stamp));
+    }
+    else {
+      lgr_out_writev(lgr, all_iov, all_cnt);
+    }
+    if (lgr->out_len > 0) {
+      lgr->out_buf_idx ^= 1;
+      lgr->out_len = 0;
+    }
+  }
+}  /* lgr_out_pieces */
+
+
+/* Flush and close the output file. */
+static void lgr_out_close(lgr_t *lgr)
+{
+  lgr_out_flush(lgr);
+  if (lgr->uring != NULL) {
+    lgr_out_wait(lgr, -1);
+  }
+  if (lgr->mmap_win != NULL) {
+    munmap(lgr->mmap_win, LGR_MMAP_WINDOW);
+    lgr->mmap_win = NULL;
+  }
+  if (lgr->flags & LGR_FLAGS_MMAP) {
+    /* Trim the preallocated space. */
+    if (ftruncate(lgr->cur_out_fd, lgr->out_file_off) != 0) {
+      CPRT_PERRNO("ERROR: lgr: ftruncate failed");
+    }
+    lgr->mmap_alloc_size = 0;
+  }
+  close(lgr->cur_out_fd);
+  lgr->cur_out_fd = -1;
+}  /* lgr_out_close */
+
+
+/* Write a binary record (LGR_FLAGS_BINARY). */
+static void lgr_bin_write(lgr_t *lgr, uint16_t rec_type, uint16_t rec_flags,
+    struct cprt_timeval *tv, lgr_sev_t severity, uint32_t fmt_id,
+    const char *payload, unsigned int payload_len)
+{
+  lgr_bin_rec_hdr_t hdr;
+  struct iovec iov[2];
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.rec_len = sizeof(hdr) + payload_len;
+  hdr.rec_type = rec_type;
+  hdr.flags = rec_flags;
+  hdr.tv_sec = tv->tv_sec;
+  hdr.tv_usec = tv->tv_usec;
+  hdr.severity = severity;
+  hdr.fmt_id = fmt_id;
+
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = (void *)payload;
+  iov[1].iov_len = payload_len;
+  lgr_out_pieces(lgr, iov, 2);
+  lgr->cur_file_size_bytes += hdr.rec_len;
+}  /* lgr_bin_write */
+
+
+/* "00" through "99", for rendering the microseconds of a time stamp. */
+static const char lgr_digit_pairs[201] =
+  "00010203040506070809101112131415161718192021222324"
+  "25262728293031323334353637383940414243444546474849"
+  "50515253545556575859606162636465666768697071727374"
+  "75767778798081828384858687888990919293949596979899";
+
+
+/* Return the day of the week for "tv_sec". localtime is only called when
+ * "tv_sec" is outside of the cached day. */
+static int lgr_ts_wday(lgr_t *lgr, time_t tv_sec)
+{
+  if (tv_sec < lgr->ts_day_start || tv_sec >= lgr->ts_day_end) {
+    struct tm tm_buf;
+
+    CPRT_LOCALTIME_R(&tv_sec, &tm_buf);  /* Parse time stamp. */
+    lgr->ts_wday = tm_buf.tm_wday;
+
+    /* Find the local midnights around tv_sec. */
+    tm_buf.tm_hour = 0;
+    tm_buf.tm_min = 0;
+    tm_buf.tm_sec = 0;
+    tm_buf.tm_isdst = -1;
+    lgr->ts_day_start = mktime(&tm_buf);
+    tm_buf.tm_mday++;
+    tm_buf.tm_hour = 0;
+    tm_buf.tm_min = 0;
+    tm_buf.tm_sec = 0;
+    tm_buf.tm_isdst = -1;
+    lgr->ts_day_end = mktime(&tm_buf);
+
+    if (tv_sec < lgr->ts_day_start || tv_sec >= lgr->ts_day_end) {
+      /* Strange time zone rules (or mktime failed); only cache this sec. */
+      lgr->ts_day_start = tv_sec;
+      lgr->ts_day_end = tv_sec + 1;
+    }
+  }
+
+  return lgr->ts_wday;
+}  /* lgr_ts_wday */
+
+
+/* Render "tv" and "severity" as a text line prefix into "buf" (at least
+ * LGR_TS_BUF_SIZE bytes). Returns the length. The date and time to the
+ * second are cached, so localtime is only called when the second changes. */
+#define LGR_TS_BUF_SIZE 64
+static int lgr_ts_render(lgr_t *lgr, char *buf, struct cprt_timeval *tv,
+    lgr_sev_t severity)
+{
+  unsigned int usec = (unsigned int)tv->tv_usec;
+  char *sev_str = lgr_sev2str(severity);
+  int len;
+
+  if (tv->tv_sec != lgr->ts_sec) {
+    struct tm tm_buf;
+    time_t tv_sec = tv->tv_sec;
+
+    CPRT_LOCALTIME_R(&tv_sec, &tm_buf);  /* Parse time stamp. */
+    lgr->ts_prefix_len = snprintf(lgr->ts_prefix, sizeof(lgr->ts_prefix),
+        "%04d/%02d/%02d %02d:%02d:%02d.",
+        tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
+        tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec);
+    if (lgr->ts_prefix_len < 0
+        || lgr->ts_prefix_len >= (int)sizeof(lgr->ts_prefix)) {
+      lgr->ts_prefix_len = 0;  /* Absurd year; don't cache. */
+    }
+    else {
+      lgr->ts_sec = tv->tv_sec;
+    }
+  }
+
+  if (lgr->ts_prefix_len == 0 || usec > 999999
+      || strlen(sev_str) > LGR_TS_BUF_SIZE - 32) {
+    /* Out of the ordinary, do it the slow way. */
+    struct tm tm_buf;
+    time_t tv_sec = tv->tv_sec;
+
+    CPRT_LOCALTIME_R(&tv_sec, &tm_buf);  /* Parse time stamp. */
+    len = snprintf(buf, LGR_TS_BUF_SIZE, "%04d/%02d/%02d %02d:%02d:%02d.%06d %s ",
+        tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
+        tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, (int)usec, sev_str);
+    return (len < LGR_TS_BUF_SIZE) ? len : LGR_TS_BUF_SIZE - 1;
+  }
+
+  memcpy(buf, lgr->ts_prefix, lgr->ts_prefix_len);
+  len = lgr->ts_prefix_len;
+  memcpy(&buf[len], &lgr_digit_pairs[(usec / 10000) * 2], 2);
+  memcpy(&buf[len + 2], &lgr_digit_pairs[((usec / 100) % 100) * 2], 2);
+  memcpy(&buf[len + 4], &lgr_digit_pairs[(usec % 100) * 2], 2);
+  len += 6;
+  buf[len++] = ' ';
+  while (*sev_str != '\0') {
+    buf[len++] = *sev_str++;
+  }
+  buf[len++] = ' ';
+
+  return len;
+}  /* lgr_ts_render */
+
+
+/* Write a message line (or binary text record) to the current file. */
+static void lgr_write_line(lgr_t *lgr, struct cprt_timeval *tv,
+    lgr_sev_t severity, const char *msg, int truncated)
+{
+  if (lgr->flags & LGR_FLAGS_BINARY) {
+    lgr_bin_write(lgr, LGR_BIN_REC_TEXT,
+        truncated ? LGR_BIN_FLAG_TRUNC : 0, tv, severity, 0,
+        msg, strlen(msg));
+  }
+  else {
+    char ts_buf[LGR_TS_BUF_SIZE];
+    struct iovec iov[LGR_OUT_MAX_PIECES];
+    int iov_cnt = 0;
+
+    iov[iov_cnt].iov_base = ts_buf;
+    iov[iov_cnt++].iov_len = lgr_ts_render(lgr, ts_buf, tv, severity);
+    iov[iov_cnt].iov_base = (void *)msg;
+    iov[iov_cnt++].iov_len = strlen(msg);
+    if (truncated) {
+      iov[iov_cnt].iov_base = LGR_TRUNC_SUFFIX;
+      iov[iov_cnt++].iov_len = sizeof(LGR_TRUNC_SUFFIX) - 1;
+    }
+    iov[iov_cnt].iov_base = "\n";
+    iov[iov_cnt++].iov_len = 1;
+    lgr_out_pieces(lgr, iov, iov_cnt);
+    lgr->cur_file_size_bytes += iov[0].iov_len + iov[1].iov_len + 1 +
+        (truncated ? sizeof(LGR_TRUNC_SUFFIX) - 1 : 0);
+  }
+}  /* lgr_write_line */
 
 
-/* Called by lgr_log() when an overflow happens. */
-void lgr_enqueue_overflow(lgr_t *lgr, unsigned int severity)
+/* FNV-1a hash of a message; also returns its length. */
+static uint64_t lgr_msg_hash(const char *msg, size_t *rtn_len)
 {
-  qerr_t qerr;
-
-  CPRT_ASSERT(severity >= 0 && severity <= LGR_LAST_SEV);
+  const unsigned char *p = (const unsigned char *)msg;
+  uint64_t hash = 0xcbf29ce484222325ULL;
 
-  CPRT_SPIN_LOCK(lgr->overflow_lock);
+  while (*p != '\0') {
+    hash ^= *p++;
+    hash *= 0x100000001b3ULL;
+  }
+  *rtn_len = (const char *)p - msg;
+  return hash;
+}  /* lgr_msg_hash */
 
-  lgr->overflows[severity] ++;
 
-  if (lgr->overflow_log_available) {
-    lgr->overflow_log_available = 0;
-    CPRT_TIMEOFDAY(&(lgr->overflow_log.tv), NULL);
-    qerr = q_enq(lgr->log_q, (void *)&(lgr->overflow_log));
-    CPRT_ASSERT(qerr == QERR_OK);  /* The q_enq should always succeed. */
+/* LGR_FLAGS_COALESCE: end the current run of repeated messages, writing
+ * its summary line (if any repeats were held back). Returns 1 if it wrote
+ * the summary. */
+static int lgr_repeat_break(lgr_t *lgr)
+{
+  int wrote = 0;
+
+  if (lgr->repeat_cnt > 0 && lgr->cur_out_fd != -1) {
+    char msg[128];
+    int64_t span_us =
+        (int64_t)(lgr->repeat_last_tv.tv_sec - lgr->repeat_first_tv.tv_sec)
+        * 1000000 + (lgr->repeat_last_tv.tv_usec - lgr->repeat_first_tv.tv_usec);
+
+    snprintf(msg, sizeof(msg),
+        "lgr: Last message repeated %" PRIu64 " times over %.3f sec",
+        lgr->repeat_cnt, (double)span_us / 1000000.0);
+    lgr_write_line(lgr, &(lgr->repeat_last_tv), lgr->repeat_sev, msg, 0);
+    wrote = 1;
   }
+  lgr->repeat_cnt = 0;
+  lgr->repeat_valid = 0;
+  return wrote;
+}  /* lgr_repeat_break */
 
-  CPRT_SPIN_UNLOCK(lgr->overflow_lock);
-}  /* lgr_enqueue_overflow */
+
+/* Write a message to the current file. Anything written ends a run of
+ * repeated messages (LGR_FLAGS_COALESCE), so the summary line always
+ * follows the message it refers to. */
+static void lgr_write(lgr_t *lgr, struct cprt_timeval *tv,
+    lgr_sev_t severity, const char *msg, int truncated)
+{
+  if (lgr->repeat_valid) {
+    lgr_repeat_break(lgr);
+  }
+  lgr_write_line(lgr, tv, severity, msg, truncated);
+}  /* lgr_write */
 
 
-lgr_err_t lgr_log(lgr_t *lgr, unsigned int severity, char *fmt, ...)
+/* LGR_FLAGS_COALESCE: returns 1 if "msg" repeats the last message written
+ * (same severity and text) within coalesce_ms of the first copy, in which
+ * case it is only counted. Otherwise returns 0 with its hash and length,
+ * for lgr_repeat_save() once it's written. */
+static int lgr_repeat_check(lgr_t *lgr, lgr_log_t *log, const char *msg,
+    int truncated, uint64_t *rtn_hash, size_t *rtn_len)
 {
-  lgr_log_t *log;
-  qerr_t qerr;
-  va_list args;
+  *rtn_hash = lgr_msg_hash(msg, rtn_len);
 
-  if (severity < 0 || severity > LGR_LAST_SEV) {
-    return LGR_ERR_SEVERITY;
+  if (! lgr->repeat_valid || *rtn_hash != lgr->repeat_hash
+      || *rtn_len != lgr->repeat_len || log->severity != lgr->repeat_sev
+      || truncated != lgr->repeat_trunc
+      || memcmp(msg, lgr->repeat_msg, *rtn_len) != 0) {
+    return 0;
   }
-  if (lgr->state != LGR_STATE_RUNNING) {
-    return LGR_ERR_EXITING;
+  if (lgr->coalesce_ms > 0) {
+    int64_t run_us =
+        (int64_t)(log->tv.tv_sec - lgr->repeat_first_tv.tv_sec) * 1000000
+        + (log->tv.tv_usec - lgr->repeat_first_tv.tv_usec);
+    if (run_us >= (int64_t)lgr->coalesce_ms * 1000) {
+      return 0;  /* Write it again; lgr_write() summarizes the run. */
+    }
   }
 
-  if (! (lgr->flags & LGR_FLAGS_NOLOCK)) {
-    CPRT_SPIN_LOCK(lgr->log_lock);
+  if (lgr->repeat_cnt == 0) {
+    CPRT_GETTIME(&(lgr->repeat_ts));  /* For lgr_repeat_idle(). */
   }
+  lgr->repeat_cnt++;
+  lgr->repeat_total++;
+  lgr->repeat_last_tv = log->tv;
+  return 1;
+}  /* lgr_repeat_check */
 
-  qerr = q_deq(lgr->pool_q, (void **)&log);
-  if (qerr == QERR_EMPTY) {
-    lgr_enqueue_overflow(lgr, severity);
-    if (! (lgr->flags & LGR_FLAGS_NOLOCK)) {
-      CPRT_SPIN_UNLOCK(lgr->log_lock);
-    }
-    return LGR_ERR_QFULL;  /* No free logs means the logger is full. */
-  }
-  CPRT_ASSERT(qerr == QERR_OK);
 
-  /* If user specified LGR_FLAGS_DEFER_TS, take timestamp in logger thread.
-   * If not, then take timestamp now. */
-  if (! (lgr->flags & LGR_FLAGS_DEFER_TS)) {
-    /* LGR_FLAGS_DEFER_TS not specified, take timestamp here. */
-    CPRT_TIMEOFDAY(&(log->tv), NULL);
-  }
-  log->severity = severity;
+/* LGR_FLAGS_COALESCE: remember the message just written, to compare the
+ * next ones with. */
+static void lgr_repeat_save(lgr_t *lgr, lgr_log_t *log, const char *msg,
+    int truncated, uint64_t hash, size_t len)
+{
+  memcpy(lgr->repeat_msg, msg, len);
+  lgr->repeat_hash = hash;
+  lgr->repeat_len = len;
+  lgr->repeat_sev = log->severity;
+  lgr->repeat_trunc = truncated;
+  lgr->repeat_first_tv = log->tv;
+  lgr->repeat_cnt = 0;
+  lgr->repeat_valid = 1;
+}  /* lgr_repeat_save */
+
+
+/* Write an lgr-internal message, time stamped now. */
+static void lgr_write_now(lgr_t *lgr, lgr_sev_t severity, const char *msg)
+{
+  struct cprt_timeval cur_tv;
 
-  /* Truncate test: preset the NUL for the max allowable message.
-   * Then do the sprintf into the full buffer (2 larger max message).
-   * Then the logger thread checks the NUL for the max allowable message. */
-  log->msg[lgr->max_msg_size] = '\0';
+  CPRT_TIMEOFDAY(&cur_tv, NULL);
+  lgr_write(lgr, &cur_tv, severity, msg, 0);
+}  /* lgr_write_now */
 
-  va_start(args, fmt);
-  /* Leave room for NUL and truncate test. */
-  vsnprintf(log->msg, lgr->max_msg_size + 2, fmt, args);
-  va_end(args);
 
-  /* The log queue should always have room. */
-  CPRT_ASSERT(q_enq(lgr->log_q, (void *)log) == QERR_OK);
+/* Return the id of "fmt" in the current binary file, writing its FMT
+ * record the first time it is used. Returns 0 if out of memory. */
+static uint32_t lgr_bin_fmt_id(lgr_t *lgr, const char *fmt)
+{
+  unsigned int mask = lgr->fmt_tbl_size - 1;
+  unsigned int i;
+  struct cprt_timeval tv;
+
+  /* Pointer hash; format strings are usually literals, so the same
+   * pointer always means the same string. */
+  i = (unsigned int)(((uintptr_t)fmt >> 3) * 2654435761u) & mask;
+  while (lgr->fmt_tbl[i] != NULL) {
+    if (lgr->fmt_tbl[i] == fmt) {
+      return lgr->fmt_tbl_ids[i];
+    }
+    i = (i + 1) & mask;
+  }
 
-  if (! (lgr->flags & LGR_FLAGS_NOLOCK)) {
-    CPRT_SPIN_UNLOCK(lgr->log_lock);
+  /* New format. Keep the table at most half full. */
+  if ((lgr->fmt_tbl_cnt + 1) * 2 > lgr->fmt_tbl_size) {
+    unsigned int new_size = lgr->fmt_tbl_size * 2;
+    const char **new_tbl;
+    uint32_t *new_ids;
+    unsigned int j;
+
+    new_tbl = (const char **)calloc(new_size, sizeof(const char *));
+    new_ids = (uint32_t *)malloc(new_size * sizeof(uint32_t));
+    if (new_tbl == NULL || new_ids == NULL) {
+      free(new_tbl);
+      free(new_ids);
+      return 0;
+    }
+    for (j = 0; j < lgr->fmt_tbl_size; j++) {
+      if (lgr->fmt_tbl[j] != NULL) {
+        i = (unsigned int)(((uintptr_t)lgr->fmt_tbl[j] >> 3) * 2654435761u)
+            & (new_size - 1);
+        while (new_tbl[i] != NULL) {
+          i = (i + 1) & (new_size - 1);
+        }
+        new_tbl[i] = lgr->fmt_tbl[j];
+        new_ids[i] = lgr->fmt_tbl_ids[j];
+      }
+    }
+    free(lgr->fmt_tbl);
+    free(lgr->fmt_tbl_ids);
+    lgr->fmt_tbl = new_tbl;
+    lgr->fmt_tbl_ids = new_ids;
+    lgr->fmt_tbl_size = new_size;
+
+    return lgr_bin_fmt_id(lgr, fmt);
   }
 
-  return LGR_ERR_OK;
-}  /* lgr_log */
+  lgr->fmt_tbl_cnt++;
+  lgr->fmt_tbl[i] = fmt;
+  lgr->fmt_tbl_ids[i] = lgr->fmt_tbl_cnt;
 
+  memset(&tv, 0, sizeof(tv));
+  lgr_bin_write(lgr, LGR_BIN_REC_FMT, 0, &tv, 0, lgr->fmt_tbl_cnt,
+      fmt, strlen(fmt));
 
-static char *wday2str[7] = {
-  "sun", "mon", "tue", "wed", "thu", "fri", "sat"
-};
+  return lgr->fmt_tbl_cnt;
+}  /* lgr_bin_fmt_id */
 
 
 void lgr_manage_file(lgr_t *lgr, int wday)
 {
-  struct cprt_timeval cur_tv;
-  struct tm tm_buf;
-
   if (lgr->cur_out_wday != wday) {
     /* New day. Close yesterday's file. */
-    if (lgr->cur_out_fp != NULL) {
-      CPRT_TIMEOFDAY(&cur_tv, NULL);
-      CPRT_LOCALTIME_R(&cur_tv.tv_sec, &tm_buf);  /* Parse time stamp. */
-      lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-          "%04d/%02d/%02d %02d:%02d:%02d.%06d %s lgr: Closing file.\n",
-          tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-          tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-          (int)cur_tv.tv_usec, lgr_sev2str(LGR_SEV_FYI));
-      fclose(lgr->cur_out_fp);
-      lgr->cur_out_fp = NULL;
+    if (lgr->cur_out_fd != -1) {
+      lgr_write_now(lgr, LGR_SEV_FYI, "lgr: Closing file.");
+      lgr_out_close(lgr);
     }
 
     /* Open new day's file. */
     snprintf(lgr->file_full_name, lgr->file_prefix_len + 5, "%s_%s",
         lgr->file_prefix, wday2str[wday]);
     CPRT_ASSERT(lgr->file_full_name[lgr->file_prefix_len + 4] == '\0');
-    lgr->cur_out_fp = fopen(lgr->file_full_name, "w");
-    if (lgr->cur_out_fp == NULL) {
-      CPRT_PERRNO("ERROR: lgr: fopen failed");
+    /* (A shared mapping needs read access too.) */
+    lgr->cur_out_fd = open(lgr->file_full_name,
+        ((lgr->flags & LGR_FLAGS_MMAP) ? O_RDWR : O_WRONLY)
+          | O_CREAT | O_TRUNC, 0666);
+    if (lgr->cur_out_fd == -1) {
+      CPRT_PERRNO("ERROR: lgr: open failed");
     }
     lgr->cur_file_size_bytes = 0;
+    lgr->out_file_off = 0;
+
+    if (lgr->cur_out_fd != -1 && (lgr->flags & LGR_FLAGS_MMAP)) {
+      /* Reserve the whole file up front (rounded up to a whole window). */
+      uint64_t alloc_size = (lgr->max_file_size_bytes + LGR_MMAP_WINDOW - 1)
+          & ~(uint64_t)(LGR_MMAP_WINDOW - 1);
+      int err = posix_fallocate(lgr->cur_out_fd, 0, alloc_size);
+      if (err != 0) {
+        errno = err;
+        CPRT_PERRNO("ERROR: lgr: posix_fallocate failed; not using mmap");
+        lgr->out_mmap = 0;
+      }
+      else {
+        lgr->mmap_alloc_size = alloc_size;
+        lgr->out_mmap = 1;
+      }
+    }
 
-    CPRT_TIMEOFDAY(&cur_tv, NULL);
-    CPRT_LOCALTIME_R(&cur_tv.tv_sec, &tm_buf);  /* Parse time stamp. */
-    lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-        "%04d/%02d/%02d %02d:%02d:%02d.%06d %s lgr: Opening file.\n",
-        tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-        tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-        (int)cur_tv.tv_usec, lgr_sev2str(LGR_SEV_FYI));
+    if (lgr->cur_out_fd != -1 && (lgr->flags & LGR_FLAGS_BINARY)) {
+      struct iovec iov;
+      lgr_bin_file_hdr_t hdr;
+
+      memset(&hdr, 0, sizeof(hdr));
+      memcpy(hdr.magic, LGR_BIN_MAGIC, sizeof(hdr.magic));
+      hdr.byte_order = LGR_BIN_BYTE_ORDER;
+      hdr.version = LGR_BIN_VERSION;
+      hdr.file_hdr_size = sizeof(lgr_bin_file_hdr_t);
+      hdr.rec_hdr_size = sizeof(lgr_bin_rec_hdr_t);
+      hdr.max_msg_size = lgr->max_msg_size;
+      hdr.ptr_size = sizeof(void *);
+      hdr.long_double_size = sizeof(long double);
+      iov.iov_base = &hdr;
+      iov.iov_len = sizeof(hdr);
+      lgr_out_pieces(lgr, &iov, 1);
+      lgr->cur_file_size_bytes += sizeof(hdr);
+
+      /* Format ids are per file. */
+      memset((void *)lgr->fmt_tbl, 0,
+          lgr->fmt_tbl_size * sizeof(const char *));
+      lgr->fmt_tbl_cnt = 0;
+    }
+
+    if (lgr->cur_out_fd != -1) {
+      lgr_write_now(lgr, LGR_SEV_FYI, "lgr: Opening file.");
+    }
 
     lgr->cur_out_wday = wday;
   }
 
-  if (lgr->cur_out_fp != NULL) {
+  if (lgr->cur_out_fd != -1) {
     unsigned int drops[LGR_LAST_SEV + 1];
     int i, tot_file_size_drops;
 
     if (lgr->cur_file_size_bytes >= lgr->max_file_size_bytes) {
-      CPRT_TIMEOFDAY(&cur_tv, NULL);
-      CPRT_LOCALTIME_R(&cur_tv.tv_sec, &tm_buf);  /* Parse time stamp. */
-      lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-          "%04d/%02d/%02d %02d:%02d:%02d.%06d %s lgr: Log file size exceeded.\n",
-          tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-          tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-          (int)cur_tv.tv_usec, lgr_sev2str(LGR_SEV_ERR));
-      fclose(lgr->cur_out_fp);
-      lgr->cur_out_fp = NULL;
+      lgr_write_now(lgr, LGR_SEV_ERR, "lgr: Log file size exceeded.");
+      lgr_out_close(lgr);
     }
 
     tot_file_size_drops = 0;
@@ -379,18 +2378,17 @@ void lgr_manage_file(lgr_t *lgr, int wday)
       lgr->file_size_drops[i] = 0;
     }
     if (tot_file_size_drops > 0) {
-      CPRT_TIMEOFDAY(&cur_tv, NULL);
-      CPRT_LOCALTIME_R(&cur_tv.tv_sec, &tm_buf);  /* Parse time stamp. */
-      lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-          "%04d/%02d/%02d %02d:%02d:%02d.%06d %s lgr: File size drops, "
+      char msg[256];
+
+      snprintf(msg, sizeof(msg), "lgr: File size drops, "
+            "TRACE:%u, DEBUG:%u, "
             "FYI:%u, ATTN:%u, WARN:%u, ERR:%u, FATAL:%u "
-            "logs dropped\n",
-          tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-          tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-          (int)cur_tv.tv_usec, lgr_sev2str(LGR_SEV_ERR),
+            "logs dropped",
+          drops[LGR_SEV_TRACE], drops[LGR_SEV_DEBUG],
           drops[LGR_SEV_FYI], drops[LGR_SEV_ATTN],
           drops[LGR_SEV_WARN], drops[LGR_SEV_ERR],
           drops[LGR_SEV_FATAL]);
+      lgr_write_now(lgr, LGR_SEV_ERR, msg);
     }
   }
 }  /* lgr_manage_file */
@@ -400,7 +2398,6 @@ void lgr_handle_oveflow(lgr_t *lgr, lgr_log_t *log)
 {
   unsigned int overflows[LGR_LAST_SEV + 1];
   struct cprt_timeval cur_tv;
-  struct tm tm_buf;
   double time_diff_sec;
   unsigned int tot_overflows;
   int i;
@@ -425,19 +2422,19 @@ void lgr_handle_oveflow(lgr_t *lgr, lgr_log_t *log)
     time_diff_sec += (double)cur_tv.tv_usec / (double)1000000;
     time_diff_sec -= (double)log->tv.tv_usec / (double)1000000;
 
-    CPRT_LOCALTIME_R(&(log->tv.tv_sec), &tm_buf);  /* Parse time stamp. */
-    lgr_manage_file(lgr, tm_buf.tm_wday);
-    if (lgr->cur_out_fp != NULL) {
-      lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-          "%04d/%02d/%02d %02d:%02d:%02d.%06d %s lgr: Overflow, "
+    lgr_manage_file(lgr, lgr_ts_wday(lgr, log->tv.tv_sec));
+    if (lgr->cur_out_fd != -1) {
+      char msg[256];
+
+      snprintf(msg, sizeof(msg), "lgr: Overflow, "
+            "TRACE:%u, DEBUG:%u, "
             "FYI:%u, ATTN:%u, WARN:%u, ERR:%u, FATAL:%u "
-            "logs dropped over %f sec\n",
-          tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-          tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-          (int)log->tv.tv_usec, lgr_sev2str(LGR_SEV_ERR),
+            "logs dropped over %f sec",
+          overflows[LGR_SEV_TRACE], overflows[LGR_SEV_DEBUG],
           overflows[LGR_SEV_FYI], overflows[LGR_SEV_ATTN],
           overflows[LGR_SEV_WARN], overflows[LGR_SEV_ERR],
           overflows[LGR_SEV_FATAL], time_diff_sec);
+      lgr_write(lgr, &(log->tv), LGR_SEV_ERR, msg, 0);
     }
   }
 }  /* lgr_handle_oveflow */
@@ -445,127 +2442,589 @@ void lgr_handle_oveflow(lgr_t *lgr, lgr_log_t *log)
 
 void lgr_handle_log(lgr_t *lgr, lgr_log_t *log)
 {
-  struct tm tm_buf;
+  uint32_t fmt_id;
+
+  lgr->logs_total++;
 
   if (lgr->flags & LGR_FLAGS_DEFER_TS) {
     CPRT_TIMEOFDAY(&(log->tv), NULL);
   }
-  /* Truncate test: log API preset the NUL for the max allowable message,
-   * then did the sprintf into the full buffer (2 larger max message).
-   * Now check the NUL for the max allowable message. */
-  char *msg_suffix = "";
-  if (log->msg[lgr->max_msg_size] != '\0') {
-    log->msg[lgr->max_msg_size] = '\0';
-    msg_suffix = "...(message truncated)";
+  else if (lgr->flags & LGR_FLAGS_TSC_TS) {
+    lgr_tsc_to_tv(lgr, log->tsc, &(log->tv));
   }
 
-  CPRT_LOCALTIME_R(&(log->tv.tv_sec), &tm_buf);  /* Parse time stamp. */
-  lgr_manage_file(lgr, tm_buf.tm_wday);
-  if (lgr->cur_out_fp != NULL) {
-    lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-        "%04d/%02d/%02d %02d:%02d:%02d.%06d %s %s%s\n",
-        tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-        tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-        (int)log->tv.tv_usec, lgr_sev2str(log->severity), log->msg,
-        msg_suffix);
-  }
-  else {  /* File closed, accumulate file size drops. */
+  lgr_manage_file(lgr, lgr_ts_wday(lgr, log->tv.tv_sec));
+  if (lgr->cur_out_fd == -1) {  /* File closed, accumulate drops. */
     CPRT_ASSERT(log->severity >= 0 && log->severity <= LGR_LAST_SEV);
     lgr->file_size_drops[log->severity] ++;
+    lgr->file_size_drops_total[log->severity] ++;
+  }
+  else if ((lgr->flags & LGR_FLAGS_BINARY) && log->fmt != NULL
+      && (fmt_id = lgr_bin_fmt_id(lgr, log->fmt)) != 0) {
+    /* Deferred log goes to the file still packed; lgr_decode formats.
+     * (Not compared for LGR_FLAGS_COALESCE, but ends a run.) */
+    if (lgr->repeat_valid) {
+      lgr_repeat_break(lgr);
+    }
+    lgr_bin_write(lgr, LGR_BIN_REC_PACKED, 0, &(log->tv), log->severity,
+        fmt_id, log->msg, log->msg_len);
+  }
+  else {
+    char *msg = log->msg;
+    int truncated = 0;
+
+    if (log->fmt != NULL) {
+      /* Deferred formatting (LGR_FLAGS_DEFER_FMT). */
+      int msg_len = lgr_fmt_render(lgr->fmt_buf, lgr->max_msg_size + 2,
+          log->fmt, log->msg, log->msg_len);
+      msg = lgr->fmt_buf;
+      if (msg_len < 0) {
+        msg = "lgr: bad deferred log args";
+      }
+      else if (msg_len > lgr->max_msg_size) {
+        msg[lgr->max_msg_size] = '\0';
+        truncated = 1;
+      }
+    }
+    /* Truncate test: log API preset the NUL for the max allowable message,
+     * then did the sprintf into the full buffer (2 larger max message).
+     * Now check the NUL for the max allowable message.
+     * (A short byte ring log does not extend that far, and a log of a
+     * smaller size class was never truncated; its buffer may be just big
+     * enough to reach that byte.) */
+    else if (log->rec_size > offsetof(lgr_log_t, msg) + lgr->max_msg_size
+        && (lgr->num_classes == 0
+            || lgr_class_of(lgr, log) == lgr->num_classes - 1)
+        && log->msg[lgr->max_msg_size] != '\0') {
+      log->msg[lgr->max_msg_size] = '\0';
+      truncated = 1;
+    }
+
+    if (lgr->flags & LGR_FLAGS_COALESCE) {
+      uint64_t hash;
+      size_t len;
+
+      if (! lgr_repeat_check(lgr, log, msg, truncated, &hash, &len)) {
+        lgr_write(lgr, &(log->tv), log->severity, msg, truncated);
+        lgr_repeat_save(lgr, log, msg, truncated, hash, len);
+      }
+    }
+    else {
+      lgr_write(lgr, &(log->tv), log->severity, msg, truncated);
+    }
   }
 
-  CPRT_ASSERT(q_enq(lgr->pool_q, (void *)log) == QERR_OK);
+  if (lgr->flags & LGR_FLAGS_STATS) {
+    lgr_hist_add(&(lgr->call_hist), lgr_stamp_ns(lgr, log->call_cost));
+    lgr_hist_add(&(lgr->queue_hist),
+        lgr_stamp_ns(lgr, lgr_stamp(lgr) - log->tsc));
+  }
 }  /* lgr_handle_log */
 
 
+/* Return handled logs to their pool (or the byte ring). Logs from the same
+ * pool are returned with a single q_enq_batch(). */
+static void lgr_free_logs(lgr_t *lgr, lgr_log_t **logs, unsigned int num_logs)
+{
+  unsigned int i, start;
+
+  start = 0;
+  for (i = 0; i <= num_logs; i++) {
+    if (i == num_logs || logs[i]->pool_q != logs[start]->pool_q) {
+      if (i > start) {
+        if (lgr->flags & LGR_FLAGS_MPMC) {
+          unsigned int j;
+          for (j = start; j < i; j++) {
+            CPRT_ASSERT(qm_enq(lgr->pool_qm, (void *)logs[j]) == QERR_OK);
+          }
+        }
+        else if (logs[start]->pool_q == NULL) {
+          unsigned int j;
+          for (j = start; j < i; j++) {
+            lgr_ring_release(lgr, logs[j]);
+          }
+        }
+        else {
+          CPRT_ASSERT(q_enq_batch(logs[start]->pool_q, (void **)&logs[start],
+              i - start) == i - start);
+        }
+      }
+      start = i;
+    }
+  }
+
+  /* Wake any lgr_log() calls that are blocked waiting for a free log. The
+   * barrier orders the pool refill before the read of block_waiters; see
+   * lgr_block_wait(). */
+  if (num_logs > 0) {
+    CPRT_MEM_BARRIER;
+    if (lgr->block_waiters > 0) {
+      lgr->free_seq++;
+      cprt_futex_wake_all(&(lgr->free_seq));
+    }
+  }
+}  /* lgr_free_logs */
+
+
+/* Free the newest chunk if all of its logs are in pool_q. Takes log_lock
+ * to become pool_q's consumer for a moment: every free log is dequeued, and
+ * all but the chunk's are put back. Returns 1 if the chunk was freed. */
+static int lgr_pool_shrink(lgr_t *lgr)
+{
+  lgr_chunk_t *chunk = &(lgr->chunks[lgr->num_chunks - 1]);
+  char *chunk_end = chunk->arena +
+      lgr_arena_size(chunk->num_logs, lgr->max_msg_size);
+  unsigned int num_logs, num_keep, i;
+
+  CPRT_SPIN_LOCK(lgr->log_lock);
+  num_logs = q_deq_batch(lgr->pool_q, (void **)lgr->pool_scratch,
+      lgr->q_size);
+  num_keep = 0;
+  for (i = 0; i < num_logs; i++) {
+    char *addr = (char *)lgr->pool_scratch[i];
+    if (addr < chunk->arena || addr >= chunk_end) {
+      lgr->pool_scratch[num_keep++] = lgr->pool_scratch[i];
+    }
+  }
+  if (num_logs - num_keep < chunk->num_logs) {
+    num_keep = num_logs;  /* Some still in use; put them all back. */
+  }
+  CPRT_ASSERT(q_enq_batch(lgr->pool_q, (void **)lgr->pool_scratch,
+      num_keep) == num_keep);
+  CPRT_SPIN_UNLOCK(lgr->log_lock);
+
+  if (num_keep == num_logs) {
+    return 0;
+  }
+  lgr_arena_free(lgr, chunk->arena, chunk->arena_size, chunk->arena_mapped);
+  chunk->arena = NULL;
+  lgr->num_chunks--;
+  lgr->pool_logs -= chunk->num_logs;
+  return 1;
+}  /* lgr_pool_shrink */
+
+
+/* Grow the pool if it is getting low (see lgr_attr_t.pool_chunk_logs).
+ * Called by the logger thread for each batch it drains, so that a burst is
+ * noticed while it is still going on. */
+static void lgr_pool_check(lgr_t *lgr)
+{
+  unsigned int in_use = lgr->pool_logs - q_count(lgr->pool_q);
+  uint64_t overflows = 0;
+  lgr_err_t err;
+  int grow, i;
+
+  if (in_use > lgr->pool_peak) {
+    lgr->pool_peak = in_use;
+  }
+  /* Any overflow since the last check also means the pool was too small
+   * (in_use can miss it, since the previous batch was just freed). */
+  for (i = 0; i <= LGR_LAST_SEV; i++) {
+    overflows += lgr->overflows_total[i];
+  }
+  grow = ((uint64_t)in_use * 100 >= (uint64_t)lgr->pool_logs * LGR_POOL_GROW_PCT
+      || overflows != lgr->pool_overflows);
+  lgr->pool_overflows = overflows;
+  if (! grow || lgr->pool_logs >= lgr->pool_max_logs) {
+    return;
+  }
+
+  err = lgr_pool_grow(lgr);
+  if (err == LGR_ERR_OK) {
+    lgr->pool_grows++;
+    CPRT_MEM_BARRIER;
+    if (lgr->block_waiters > 0) {  /* See lgr_free_logs(). */
+      lgr->free_seq++;
+      cprt_futex_wake_all(&(lgr->free_seq));
+    }
+  }
+  else {
+    /* Don't keep retrying; stay at the current size. */
+    lgr->pool_max_logs = lgr->pool_logs;
+    if (lgr->cur_out_fd != -1) {
+      char msg[128];
+
+      snprintf(msg, sizeof(msg), "lgr: Can't grow log pool past %u logs: %s",
+          lgr->pool_logs, lgr_err2str(err));
+      lgr_write_now(lgr, LGR_SEV_WARN, msg);
+    }
+  }
+  CPRT_GETTIME(&(lgr->pool_window_ts));  /* Restart the idle window. */
+}  /* lgr_pool_check */
+
+
+/* Free the newest chunk if the pool has been mostly idle for pool_shrink_ms.
+ * Called by the logger thread each time around its loop. */
+static void lgr_pool_idle(lgr_t *lgr)
+{
+  struct cprt_timespec cur_ts;
+  uint64_t window_ns;
+  unsigned int remain;
+
+  if (lgr->num_chunks <= 1) {
+    return;
+  }
+  CPRT_GETTIME(&cur_ts);
+  CPRT_DIFF_TS(window_ns, cur_ts, lgr->pool_window_ts);
+  if (window_ns < (uint64_t)lgr->pool_shrink_ms * 1000000) {
+    return;
+  }
+
+  /* Only if the window's peak would leave the pool under half used, so
+   * that it doesn't grow right back. */
+  remain = lgr->pool_logs - lgr->chunks[lgr->num_chunks - 1].num_logs;
+  if (lgr->pool_peak * 2 <= remain && lgr_pool_shrink(lgr)) {
+    lgr->pool_shrinks++;
+  }
+  lgr->pool_window_ts = cur_ts;
+  lgr->pool_peak = lgr->pool_logs - q_count(lgr->pool_q);
+}  /* lgr_pool_idle */
+
+
+/* Drain a log queue, LGR_DRAIN_BATCH logs at a time: one q_deq_batch(),
+ * handle each log, then one lgr_free_logs(). A NULL "log_q" means
+ * lgr->log_qm (LGR_FLAGS_MPMC). Sets *quitting if the quit log is seen.
+ * Returns number of logs. */
+static int lgr_drain_q(lgr_t *lgr, q_t *log_q, int *quitting)
+{
+  lgr_log_t *logs[LGR_DRAIN_BATCH];
+  lgr_log_t *frees[LGR_DRAIN_BATCH];
+  unsigned int cnt, num_frees, i;
+  int num_logs = 0;
+
+  for (;;) {
+    if (log_q == NULL) {  /* LGR_FLAGS_MPMC. */
+      for (cnt = 0; cnt < LGR_DRAIN_BATCH
+          && qm_deq(lgr->log_qm, (void **)&logs[cnt]) == QERR_OK; cnt++) {
+      }
+    }
+    else {
+      cnt = q_deq_batch(log_q, (void **)logs, LGR_DRAIN_BATCH);
+    }
+    if (cnt == 0) {
+      break;
+    }
+    if (lgr->pool_chunk_logs > 0) {
+      lgr_pool_check(lgr);
+    }
+    if (lgr->flags & LGR_FLAGS_STATS) {
+      unsigned int waiting = cnt + ((log_q == NULL)
+          ? qm_count(lgr->log_qm) : q_count(log_q));
+      if (waiting > lgr->log_q_hwm) {
+        lgr->log_q_hwm = waiting;
+      }
+    }
+
+    num_frees = 0;
+    for (i = 0; i < cnt; i++) {
+      lgr_log_t *log = logs[i];
+
+      if (log->type == LGR_LOG_TYPE_MSG) {
+        lgr_handle_log(lgr, log);
+        frees[num_frees++] = log;
+      }
+      else if (log->type == LGR_LOG_TYPE_QUIT) {
+        *quitting = 1;
+      }
+      else if (log->type == LGR_LOG_TYPE_OVERFLOW) {
+        lgr_handle_oveflow(lgr, log);
+      }
+      else {  /* Bad log type; log object corrupted? */
+        struct cprt_timeval cur_tv;
+
+        CPRT_TIMEOFDAY(&cur_tv, NULL);
+        lgr_manage_file(lgr, lgr_ts_wday(lgr, cur_tv.tv_sec));
+        if (lgr->cur_out_fd != -1) {
+          char msg[64];
+
+          snprintf(msg, sizeof(msg), "Bad log type (%d)", log->type);
+          lgr_write(lgr, &cur_tv, LGR_SEV_ERR, msg, 0);
+        }
+        /* Corrupted log object, do not put it into the pool. */
+      }
+    }
+    lgr_free_logs(lgr, frees, num_frees);
+    num_logs += cnt;
+  }
+
+  return num_logs;
+}  /* lgr_drain_q */
+
+
+/* Drain registered app threads' log queues (LGR_FLAGS_PER_THREAD), and
+ * free the queues of threads that have exited. Returns number of logs. */
+int lgr_drain_threads(lgr_t *lgr)
+{
+  lgr_thread_t *thr, *next;
+  int quitting = 0;  /* App thread queues never hold the quit log. */
+  int num_logs = 0;
+
+  for (thr = lgr->threads; thr != NULL; thr = next) {
+    next = thr->next;
+
+    num_logs += lgr_drain_q(lgr, thr->log_q, &quitting);
+
+    if (thr->exited) {
+      lgr_thread_t **link;
+
+      /* The exited flag was set after the thread's last enqueue. */
+      CPRT_MEM_BARRIER;
+      num_logs += lgr_drain_q(lgr, thr->log_q, &quitting);
+
+      /* New threads are pushed onto the head concurrently, so find the
+       * link to this one under the lock. */
+      CPRT_SPIN_LOCK(lgr->log_lock);
+      link = (lgr_thread_t **)&(lgr->threads);
+      while (*link != thr) {
+        link = &((*link)->next);
+      }
+      *link = next;
+      CPRT_SPIN_UNLOCK(lgr->log_lock);
+
+      lgr_thread_free(thr);
+    }
+  }
+
+  return num_logs;
+}  /* lgr_drain_threads */
+
+
+/* Returns 1 if no registered app thread has a log waiting. */
+int lgr_threads_empty(lgr_t *lgr)
+{
+  lgr_thread_t *thr;
+
+  for (thr = lgr->threads; thr != NULL; thr = thr->next) {
+    if (! q_is_empty(thr->log_q)) {
+      return 0;
+    }
+  }
+  return 1;
+}  /* lgr_threads_empty */
+
+
+/* Wait for a log to arrive (LGR_FLAGS_WAKEUP): spin for spin_us, then
+ * park until lgr_wake() is called (or LGR_PARK_MS passes, or a pending
+ * LGR_FLAGS_COALESCE summary is due). */
+static void lgr_wait(lgr_t *lgr)
+{
+  struct cprt_timespec start_ts, cur_ts;
+  uint64_t spin_ns;
+  int park_ms = LGR_PARK_MS;
+
+  CPRT_GETTIME(&start_ts);
+  for (;;) {
+    if (! lgr_log_q_empty(lgr) || ! lgr_threads_empty(lgr)) {
+      return;
+    }
+    CPRT_GETTIME(&cur_ts);
+    CPRT_DIFF_TS(spin_ns, cur_ts, start_ts);
+    if (spin_ns >= (uint64_t)lgr->spin_us * 1000) {
+      break;
+    }
+    CPRT_CPU_PAUSE();
+  }
+
+  if (lgr->repeat_cnt > 0 && lgr->coalesce_ms > 0) {
+    /* Wake up in time to write the pending repeat summary. */
+    uint64_t run_ns, left_ns;
+
+    CPRT_DIFF_TS(run_ns, cur_ts, lgr->repeat_ts);
+    left_ns = (uint64_t)lgr->coalesce_ms * 1000000;
+    if (run_ns >= left_ns) {
+      return;  /* Already due. */
+    }
+    left_ns -= run_ns;
+    if (left_ns < (uint64_t)park_ms * 1000000) {
+      park_ms = (int)((left_ns + 999999) / 1000000);
+    }
+  }
+
+  lgr->sleeping = 1;
+  CPRT_MEM_BARRIER;  /* See lgr_wake(). */
+  if (lgr_log_q_empty(lgr) && lgr_threads_empty(lgr)) {
+    cprt_futex_wait(&(lgr->sleeping), 1, park_ms);
+  }
+  lgr->sleeping = 0;
+}  /* lgr_wait */
+
+
+/* LGR_FLAGS_COALESCE: write the summary of a run of repeats that has been
+ * held back for coalesce_ms. Called by the logger thread each time around
+ * its loop. Returns 1 if it wrote the summary. */
+static int lgr_repeat_idle(lgr_t *lgr)
+{
+  struct cprt_timespec cur_ts;
+  uint64_t run_ns;
+
+  CPRT_GETTIME(&cur_ts);
+  CPRT_DIFF_TS(run_ns, cur_ts, lgr->repeat_ts);
+  if (run_ns >= (uint64_t)lgr->coalesce_ms * 1000000) {
+    return lgr_repeat_break(lgr);
+  }
+  return 0;
+}  /* lgr_repeat_idle */
+
+
+/* Report and reset rate limited and sampled call sites. Called by the
+ * logger thread every LGR_SITE_WINDOW_MS, and at exit. */
+static void lgr_handle_sites(lgr_t *lgr, int exiting)
+{
+  lgr_site_t *site;
+
+  CPRT_SPIN_LOCK(lgr->site_lock);
+  for (site = lgr->sites; site != NULL; site = site->next) {
+    unsigned int cnt = CPRT_ATOMIC_XCHG(&(site->cnt), 0);
+    unsigned int passed;
+
+    if (site->sample_n > 0) {
+      passed = (cnt + site->sample_n - 1) / site->sample_n;
+    }
+    else {
+      passed = (cnt < site->per_sec) ? cnt : site->per_sec;
+    }
+    if (cnt > passed) {
+      struct cprt_timeval cur_tv;
+
+      lgr->suppressed_total += cnt - passed;
+
+      CPRT_TIMEOFDAY(&cur_tv, NULL);
+      if (! exiting) {
+        lgr_manage_file(lgr, lgr_ts_wday(lgr, cur_tv.tv_sec));
+      }
+      if (lgr->cur_out_fd != -1) {
+        char msg[256];
+
+        snprintf(msg, sizeof(msg), "lgr: Suppressed %u logs from %s:%d",
+            cnt - passed, site->file, site->line);
+        lgr_write(lgr, &cur_tv, site->severity, msg, 0);
+      }
+    }
+  }
+  CPRT_SPIN_UNLOCK(lgr->site_lock);
+}  /* lgr_handle_sites */
+
+
+
+
+/* Apply lgr_attr_t cpu_mask, sched_policy, and thread_name to the calling
+ * (logger) thread. */
+static lgr_err_t lgr_thread_place(lgr_t *lgr)
+{
+  if (lgr->cpu_mask != 0 && cprt_try_affinity(lgr->cpu_mask) != 0) {
+    return LGR_ERR_THREAD;
+  }
+  if (lgr->sched_policy != -1
+      && cprt_try_sched(lgr->sched_policy, lgr->sched_priority) != 0) {
+    return LGR_ERR_THREAD;
+  }
+  if (lgr->thread_name[0] != '\0'
+      && cprt_try_thread_name(lgr->thread_name) != 0) {
+    return LGR_ERR_THREAD;
+  }
+  return LGR_ERR_OK;
+}  /* lgr_thread_place */
+
+
 CPRT_THREAD_ENTRYPOINT lgr_thread(void *in_arg)
 {
   lgr_t *lgr = (lgr_t *)in_arg;
   struct cprt_timeval cur_tv;
-  struct tm tm_buf;
   int need_flush;
   int quitting;
 
-  lgr->cur_out_fp = NULL;
+  /* Placement first, so that even file creation runs where requested. */
+  lgr->thread_err = lgr_thread_place(lgr);
+  if (lgr->thread_err != LGR_ERR_OK) {
+    lgr->state = LGR_STATE_EXITING;  /* Release "lgr_create()" with error. */
+    CPRT_THREAD_EXIT;
+  }
+
+  lgr->cur_out_fd = -1;
   /* Guarantee first call to lgr_manage_file() results in "day change". */
   lgr->cur_out_wday = 99;
 
   CPRT_TIMEOFDAY(&cur_tv, NULL);
-  CPRT_LOCALTIME_R(&cur_tv.tv_sec, &tm_buf);  /* Parse time stamp. */
-  lgr_manage_file(lgr, tm_buf.tm_wday);
-  if (lgr->cur_out_fp != NULL) {
-    lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-      "%04d/%02d/%02d %02d:%02d:%02d.%06d %s lgr: Starting.\n",
-      tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-      tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-      (int)cur_tv.tv_usec, lgr_sev2str(LGR_SEV_FYI));
+  lgr_manage_file(lgr, lgr_ts_wday(lgr, cur_tv.tv_sec));
+  if (lgr->cur_out_fd != -1) {
+    lgr_write(lgr, &cur_tv, LGR_SEV_FYI, "lgr: Starting.", 0);
   }
   need_flush = 1;
 
+  CPRT_GETTIME(&(lgr->site_window_ts));
+  CPRT_GETTIME(&(lgr->pool_window_ts));
+
   /* Release the "lgr_create()" call. */
   lgr->state = LGR_STATE_RUNNING;
 
   quitting = 0;
   while (! quitting) {
-    lgr_log_t *log;
-    qerr_t qerr;
-    while ((qerr = q_deq(lgr->log_q, (void **)&log)) == QERR_OK) {
+    if ((lgr->flags & LGR_FLAGS_TSC_TS) && CPRT_RDTSC() >= lgr->tsc_next_cal) {
+      lgr_tsc_calibrate(lgr);
+    }
+
+    if (lgr_drain_threads(lgr) > 0) {
       need_flush = 1;
+    }
 
-      if (log->type == LGR_LOG_TYPE_QUIT) {
-        quitting = 1;
-      }
-      else if (log->type == LGR_LOG_TYPE_OVERFLOW) {
-        lgr_handle_oveflow(lgr, log);
-      }
-      else if (log->type == LGR_LOG_TYPE_MSG) {
-        lgr_handle_log(lgr, log);
+    if (lgr_drain_q(lgr, lgr->log_q, &quitting) > 0) {
+      need_flush = 1;
+    }
+
+    if (lgr->repeat_cnt > 0 && lgr->coalesce_ms > 0 && ! quitting) {
+      if (lgr_repeat_idle(lgr)) {
+        need_flush = 1;
       }
-      else {  /* Bad log type; log object corrupted? */
-        CPRT_TIMEOFDAY(&cur_tv, NULL);
-        CPRT_LOCALTIME_R(&cur_tv.tv_sec, &tm_buf);  /* Parse time stamp. */
-        lgr_manage_file(lgr, tm_buf.tm_wday);
-        if (lgr->cur_out_fp != NULL) {
-          lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-            "%04d/%02d/%02d %02d:%02d:%02d.%06d %s Bad log type (%d)\n",
-            tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-            tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-            (int)log->tv.tv_usec, lgr_sev2str(LGR_SEV_ERR),
-            log->type);
-        }
-        /* Corrupted log object, do not put it into the pool. */
+    }
+
+    if (lgr->pool_shrink_ms > 0 && ! quitting) {
+      lgr_pool_idle(lgr);
+    }
+
+    if (lgr->sites != NULL) {
+      struct cprt_timespec cur_ts;
+      uint64_t window_ns;
+
+      CPRT_GETTIME(&cur_ts);
+      CPRT_DIFF_TS(window_ns, cur_ts, lgr->site_window_ts);
+      if (window_ns >= (uint64_t)LGR_SITE_WINDOW_MS * 1000000) {
+        lgr_handle_sites(lgr, 0);
+        lgr->site_window_ts = cur_ts;
+        need_flush = 1;
       }
-    }  /* while dequeue */
-    CPRT_ASSERT(qerr == QERR_EMPTY);
+    }
 
     if (! quitting) {
       /* Log queue empty, flush log file if needed. */
       if (need_flush) {
-        if (lgr->cur_out_fp != NULL) {
-          fflush(lgr->cur_out_fp);
+        if (lgr->cur_out_fd != -1) {
+          lgr_out_flush(lgr);
         }
         need_flush = 0;
       }
 
-      /* If log queue still empty, sleep. */
-      if (q_is_empty(lgr->log_q)) {
-        CPRT_SLEEP_MS(lgr->sleep_ms);
+      /* If log queues still empty, sleep. */
+      if (lgr_log_q_empty(lgr) && lgr_threads_empty(lgr)) {
+        if (lgr->flags & LGR_FLAGS_WAKEUP) {
+          lgr_wait(lgr);
+        }
+        else {
+          CPRT_SLEEP_MS(lgr->sleep_ms);
+        }
       }
     }
   }  /* while ! quitting */
 
+  /* App threads may have logged just before lgr_delete(). */
+  lgr_drain_threads(lgr);
+  lgr_handle_sites(lgr, 1);
+
   CPRT_TIMEOFDAY(&cur_tv, NULL);
-  CPRT_LOCALTIME_R(&cur_tv.tv_sec, &tm_buf);  /* Parse time stamp. */
   /* Don't call lgr_manage_file(). Don't want to create new file for exit. */
-  if (lgr->cur_out_fp != NULL) {
-    lgr->cur_file_size_bytes += fprintf(lgr->cur_out_fp,
-      "%04d/%02d/%02d %02d:%02d:%02d.%06d %s lgr: Exiting.\n",
-      tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-      tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
-      (int)cur_tv.tv_usec, lgr_sev2str(LGR_SEV_FYI));
-
-    fclose(lgr->cur_out_fp);
-    lgr->cur_out_fp = NULL;
+  if (lgr->cur_out_fd != -1) {
+    lgr_write(lgr, &cur_tv, LGR_SEV_FYI, "lgr: Exiting.", 0);
+
+    lgr_out_close(lgr);
   }
 
   CPRT_THREAD_EXIT;
@@ -14,8 +14,10 @@
 #define LGR_H
 
 #include <inttypes.h>
+#include <stdarg.h>
 #include "cprt.h"
 #include "q.h"
+#include "qm.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +26,20 @@ extern "C" {
 /* Values for lgr_create() flags parameter (and lgr_t.flags field). */
 #define LGR_FLAGS_NOLOCK   0x00000001
 #define LGR_FLAGS_DEFER_TS 0x00000002
+#define LGR_FLAGS_PER_THREAD 0x00000004  /* Per-app-thread queues, no log_lock. */
+#define LGR_FLAGS_BYTE_RING  0x00000008  /* Variable-length log storage. */
+#define LGR_FLAGS_DEFER_FMT  0x00000010  /* Format in logger thread. */
+#define LGR_FLAGS_BINARY     0x00000020  /* Binary log files; see lgr_decode. */
+#define LGR_FLAGS_TSC_TS     0x00000040  /* Time stamp with CPU TSC. */
+#define LGR_FLAGS_IO_URING   0x00000080  /* Asynchronous file writes. */
+#define LGR_FLAGS_MMAP       0x00000100  /* Preallocated, mapped files. */
+#define LGR_FLAGS_WAKEUP     0x00000200  /* Wake logger instead of polling. */
+#define LGR_FLAGS_MPMC       0x00000400  /* Lock-free multi-producer queues. */
+#define LGR_FLAGS_HUGEPAGES  0x00000800  /* Log buffers in 2 MB pages. */
+#define LGR_FLAGS_PREFAULT   0x00001000  /* Touch log buffers at create. */
+#define LGR_FLAGS_MLOCK      0x00002000  /* Lock log buffers in memory. */
+#define LGR_FLAGS_STATS      0x00004000  /* Latency histograms. */
+#define LGR_FLAGS_COALESCE   0x00008000  /* Summarize repeated messages. */
 
 typedef unsigned int lgr_err_t;     /* See LGR_ERR_* definitions below. */
 
@@ -37,19 +53,36 @@ typedef unsigned int lgr_err_t;     /* See LGR_ERR_* definitions below. */
 #define LGR_ERR_QFULL 5    /* No room in queue. */
 #define LGR_ERR_EXITING 6  /* Lgr is exiting. */
 #define LGR_ERR_SEVERITY 7 /* Bad severity value. */
-#define LGR_LAST_ERR 7     /* Set to value of last "LGR_ERR_*" definition. */
+#define LGR_ERR_FLAGS 8    /* Incompatible combination of flags. */
+#define LGR_ERR_RINGSIZE 9 /* Supplied ring_size invalid. */
+#define LGR_ERR_OUTBUFSIZE 10  /* Supplied out_buf_size not > 0. */
+#define LGR_ERR_RESERVE 11 /* Supplied sev_reserve leaves no logs. */
+#define LGR_ERR_MLOCK 12   /* LGR_FLAGS_MLOCK: mlock() failed. */
+#define LGR_ERR_THREAD 13  /* Logger thread cpu_mask/sched/name failed. */
+#define LGR_ERR_NUMA 14    /* Couldn't bind log buffers to numa_node. */
+#define LGR_ERR_CLASSES 15 /* Supplied class_msg_size/class_logs invalid. */
+#define LGR_LAST_ERR 15    /* Set to value of last "LGR_ERR_*" definition. */
 
 
 typedef unsigned int lgr_sev_t;  /* See LGR_SEV_* definitions below. */
 
 /* When logging a message, caller specifies a severity. These definitions
  * must be kept in sync with the "lgr_sevs" string array in "lgr.c". */
-#define LGR_SEV_FYI  0   /* Informational. */
-#define LGR_SEV_ATTN 1   /* No error, but intended to get attention. */
-#define LGR_SEV_WARN 2   /* Error, but funny handled. */
-#define LGR_SEV_ERR  3   /* Error, not fully handled, but can continue. */
-#define LGR_SEV_FATAL 4  /* Error, cannot continue. */
-#define LGR_LAST_SEV 4   /* Set to value of last "LGR_SEV_*" definition. */
+#define LGR_SEV_TRACE 0  /* Detailed tracing. */
+#define LGR_SEV_DEBUG 1  /* Debugging. */
+#define LGR_SEV_FYI  2   /* Informational. */
+#define LGR_SEV_ATTN 3   /* No error, but intended to get attention. */
+#define LGR_SEV_WARN 4   /* Error, but funny handled. */
+#define LGR_SEV_ERR  5   /* Error, not fully handled, but can continue. */
+#define LGR_SEV_FATAL 6  /* Error, cannot continue. */
+#define LGR_LAST_SEV 6   /* Set to value of last "LGR_SEV_*" definition. */
+
+/* Compile-time severity floor for LGR_LOG(). Calls with a constant
+ * severity below it compile to nothing. For example, build with
+ * -DLGR_MIN_SEV_COMPILED=LGR_SEV_FYI to remove TRACE and DEBUG logging. */
+#ifndef LGR_MIN_SEV_COMPILED
+#define LGR_MIN_SEV_COMPILED LGR_SEV_TRACE
+#endif
 
 
 /* Log entry. */
@@ -59,17 +92,220 @@ typedef unsigned int lgr_sev_t;  /* See LGR_SEV_* definitions below. */
 
 struct lgr_log_s {
   struct cprt_timeval tv;
+  uint64_t tsc;        /* LGR_FLAGS_TSC_TS: raw time stamp; logger thread
+                        * converts it to tv. Else LGR_FLAGS_STATS: enqueue
+                        * time (monotonic ns). */
   unsigned int type;   /* LGR_LOG_TYPE_* */
   lgr_sev_t severity;  /* LGR_SEV_* */
+  q_t *pool_q;         /* Pool that this log object is returned to (NULL
+                        * for byte ring logs). */
+  const char *fmt;     /* LGR_FLAGS_DEFER_FMT: msg holds packed args for
+                        * this format; NULL if msg is already formatted. */
+  unsigned int rec_size;  /* Bytes of storage occupied by this log. */
+  unsigned int msg_len;   /* Bytes of packed args (if fmt != NULL). */
+  uint32_t call_cost;  /* LGR_FLAGS_STATS: lgr_log() duration, in the
+                        * units of tsc. */
   char msg[1];
 };
 typedef struct lgr_log_s lgr_log_t;
 
+/* Appended to messages longer than max_msg_size. */
+#define LGR_TRUNC_SUFFIX "...(message truncated)"
+
+/* Binary log file format (LGR_FLAGS_BINARY). A file is an lgr_bin_file_hdr_t
+ * followed by records. Each record is an lgr_bin_rec_hdr_t followed by
+ * (rec_len - sizeof(lgr_bin_rec_hdr_t)) bytes of payload. Integers are in
+ * the writer's byte order (see byte_order). */
+#define LGR_BIN_MAGIC "LGRBIN\n"   /* 8 bytes including NUL. */
+#define LGR_BIN_VERSION 2  /* 2: TRACE and DEBUG severities added. */
+#define LGR_BIN_BYTE_ORDER 0x01020304
+
+struct lgr_bin_file_hdr_s {
+  char magic[8];               /* LGR_BIN_MAGIC */
+  uint32_t byte_order;         /* LGR_BIN_BYTE_ORDER */
+  uint32_t version;            /* LGR_BIN_VERSION */
+  uint32_t file_hdr_size;      /* sizeof(lgr_bin_file_hdr_t) */
+  uint32_t rec_hdr_size;       /* sizeof(lgr_bin_rec_hdr_t) */
+  uint32_t max_msg_size;       /* For truncating packed messages. */
+  uint32_t ptr_size;           /* sizeof(void *), for packed "%p" args. */
+  uint32_t long_double_size;   /* For packed "%Lf" args. */
+  uint32_t reserved;
+};
+typedef struct lgr_bin_file_hdr_s lgr_bin_file_hdr_t;
+
+/* Binary record types. */
+#define LGR_BIN_REC_TEXT 1     /* Payload is the message text (no NUL). */
+#define LGR_BIN_REC_FMT 2      /* Payload is format string fmt_id (no NUL). */
+#define LGR_BIN_REC_PACKED 3   /* Payload is lgr_fmt_pack() args for fmt_id. */
+
+/* Binary record flags. */
+#define LGR_BIN_FLAG_TRUNC 0x0001  /* Text message was truncated. */
+
+struct lgr_bin_rec_hdr_s {
+  uint32_t rec_len;            /* Including this header. */
+  uint16_t rec_type;           /* LGR_BIN_REC_* */
+  uint16_t flags;              /* LGR_BIN_FLAG_* */
+  int64_t tv_sec;
+  uint32_t tv_usec;
+  uint32_t severity;           /* LGR_SEV_* */
+  uint32_t fmt_id;             /* LGR_BIN_REC_FMT and LGR_BIN_REC_PACKED. */
+  uint32_t reserved;
+};
+typedef struct lgr_bin_rec_hdr_s lgr_bin_rec_hdr_t;
+
+/* The logger thread dequeues (and frees) up to this many logs at a time. */
+#define LGR_DRAIN_BATCH 64
+
+/* Latency histogram (LGR_FLAGS_STATS). buckets[i] counts durations in
+ * [2^i, 2^(i+1)) nanoseconds (bucket 0 includes 0); the last bucket also
+ * counts everything longer. */
+#define LGR_HIST_BUCKETS 32
+struct lgr_hist_s {
+  uint64_t cnt;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+  uint64_t buckets[LGR_HIST_BUCKETS];
+};
+typedef struct lgr_hist_s lgr_hist_t;
+
+/* Snapshot returned by lgr_get_stats(). Counts are totals since
+ * lgr_create(). */
+struct lgr_stats_s {
+  uint64_t logs;               /* Logs taken by the logger thread. */
+  uint64_t overflows[LGR_LAST_SEV + 1];  /* Dropped: no free log. */
+  uint64_t file_size_drops[LGR_LAST_SEV + 1];  /* Dropped: file full. */
+  uint64_t suppressed;         /* By LGR_LOG_RATELIMITED()/SAMPLED(). */
+  uint64_t coalesced;          /* Repeats summarized (LGR_FLAGS_COALESCE). */
+  uint64_t blocked_logs;       /* See lgr_attr_t.block_us. */
+  uint64_t blocked_ns;
+  uint64_t blocked_timeouts;
+  unsigned int pool_logs;      /* Log buffers currently allocated. */
+  uint64_t pool_grows;         /* See lgr_attr_t.pool_chunk_logs. */
+  uint64_t pool_shrinks;
+  /* LGR_FLAGS_STATS only (zero otherwise). */
+  unsigned int log_q_hwm;      /* Most logs seen waiting in a log queue. */
+  lgr_hist_t call_ns;          /* lgr_log() duration (accepted logs). */
+  lgr_hist_t queue_ns;         /* lgr_log() return to written to buffer. */
+  lgr_hist_t write_ns;         /* Output buffer write to the file. */
+};
+typedef struct lgr_stats_s lgr_stats_t;
+
+/* Rate limited and sampled call sites are reported and reset this often. */
+#define LGR_SITE_WINDOW_MS 1000
+
+/* Blocked lgr_log() calls spin this long before parking. */
+#define LGR_BLOCK_SPIN_US 20
+
+/* LGR_FLAGS_WAKEUP: longest time the logger thread stays parked. */
+#define LGR_PARK_MS 1000
+
+/* LGR_FLAGS_MMAP: bytes mapped at a time. Power of 2, multiple of the
+ * page size. */
+#define LGR_MMAP_WINDOW (4 * 1024 * 1024)
+
+/* Log buffers in the arena start on this boundary (a cache line). */
+#define LGR_LOG_ALIGN 64
+
+/* Most log buffer size classes (see lgr_attr_t.class_msg_size). */
+#define LGR_MAX_CLASSES 4
+
+/* lgr_attr_t.pool_chunk_logs: the logger thread adds a chunk when at least
+ * this percent of the pool is in use. */
+#define LGR_POOL_GROW_PCT 75
+
+/* LGR_FLAGS_HUGEPAGES: arenas are rounded up to this size. */
+#define LGR_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* Byte ring records start on this boundary. Must be a power of 2 and at
+ * least the size of the lgr_log_t header. */
+#define LGR_RING_ALIGN 64
+
+/* Creation attributes for lgr_create_attr(). Call lgr_attr_init() to get
+ * defaults, then override fields as needed. */
+struct lgr_attr_s {
+  unsigned int max_msg_size;
+  unsigned int q_size;
+  unsigned int sleep_ms;
+  uint32_t flags;              /* See LGR_FLAGS_* constants above. */
+  char *file_prefix;
+  int max_file_size_mb;
+  uint64_t ring_size;          /* LGR_FLAGS_BYTE_RING: bytes, power of 2.
+                                * 0 = q_size * 256. */
+  unsigned int out_buf_size;   /* Bytes in each of the two output buffers. */
+  unsigned int spin_us;        /* LGR_FLAGS_WAKEUP: logger spins this long
+                                * before parking. */
+  unsigned int block_us;       /* lgr_log() waits up to this long for a free
+                                * log before overflowing (0 = don't wait). */
+  unsigned int sev_reserve[LGR_LAST_SEV + 1];  /* Per severity: logs that
+                                * must stay free for a log to be accepted. */
+  lgr_sev_t min_sev;           /* Logs below this severity are discarded. */
+  uint64_t cpu_mask;           /* Logger thread CPUs, bit per CPU (0 = any). */
+  int sched_policy;            /* Logger thread policy, e.g. SCHED_FIFO
+                                * (-1 = inherit from creator). */
+  int sched_priority;          /* Used if sched_policy != -1. */
+  char *thread_name;           /* Logger thread name (NULL = inherit). */
+  int numa_node;               /* Node for log buffers (-1 = OS default). */
+  unsigned int class_msg_size[LGR_MAX_CLASSES];  /* Size classes: message
+                                * capacity of each, ascending, the last one
+                                * used = max_msg_size (all 0 = one class). */
+  unsigned int class_logs[LGR_MAX_CLASSES];  /* Logs in each size class;
+                                * total at most q_size - 3. */
+  unsigned int pool_chunk_logs;  /* Allocate the pool this many logs at a
+                                * time, growing up to q_size - 3 as needed
+                                * (0 = all at create). */
+  unsigned int pool_shrink_ms; /* pool_chunk_logs: free chunks not needed
+                                * for this long (0 = never). */
+  unsigned int coalesce_ms;    /* LGR_FLAGS_COALESCE: summarize a run of
+                                * repeats at least this often (0 = only
+                                * when it ends). */
+};
+typedef struct lgr_attr_s lgr_attr_t;
+
 /* Values for lgr_t.state */
 #define LGR_STATE_INITIALIZING 1
 #define LGR_STATE_RUNNING 2
 #define LGR_STATE_EXITING 3
 
+struct lgr_s;
+
+/* A block of pool log buffers (see lgr_attr_t.pool_chunk_logs). */
+struct lgr_chunk_s {
+  char *arena;
+  size_t arena_size;
+  int arena_mapped;
+  unsigned int num_logs;
+};
+typedef struct lgr_chunk_s lgr_chunk_t;
+
+/* Per-application-thread queues (see LGR_FLAGS_PER_THREAD). The app thread
+ * is the only consumer of pool_q and the only producer of log_q; the logger
+ * thread is the other side of both. */
+struct lgr_thread_s {
+  struct lgr_thread_s *next;   /* List of registered threads. */
+  struct lgr_s *lgr;
+  q_t *pool_q;
+  q_t *log_q;
+  char *arena;                 /* This thread's log buffers. */
+  size_t arena_size;
+  int arena_mapped;
+  volatile int exited;         /* Set by TLS destructor on thread exit. */
+};
+typedef struct lgr_thread_s lgr_thread_t;
+
+/* Call site state for LGR_LOG_RATELIMITED() and LGR_LOG_SAMPLED().
+ * Each use of those macros has its own static instance. */
+struct lgr_site_s {
+  volatile unsigned int cnt;   /* Calls in the current window. */
+  unsigned int per_sec;        /* Rate limit; 0 if sampled. */
+  unsigned int sample_n;       /* Log 1 in sample_n calls; 0 if rate limited. */
+  lgr_sev_t severity;
+  const char *file;
+  int line;
+  struct lgr_s * volatile lgr;  /* Logger the site is registered with. */
+  struct lgr_site_s *next;     /* List of lgr_t.sites. */
+};
+typedef struct lgr_site_s lgr_site_t;
+
 /* Logger object. */
 struct lgr_s {
   unsigned int q_size;
@@ -82,33 +318,216 @@ struct lgr_s {
   int file_prefix_len;
   uint64_t cur_file_size_bytes;
   char *file_full_name;
-  FILE *cur_out_fp;            /* Output stream. */
+  int cur_out_fd;              /* Output file (-1 = not open). */
+  char *out_bufs[2];           /* Output buffers (see lgr_out_*() in lgr.c). */
+  int out_buf_idx;             /* Buffer being filled. */
+  size_t out_len;              /* Bytes in buffer being filled. */
+  size_t out_buf_size;
+  uint64_t out_file_off;       /* File offset for next write. */
+  size_t out_inflight[2];      /* LGR_FLAGS_IO_URING: bytes being written
+                                * from each buffer (0 = buffer is free). */
+  uint64_t out_inflight_off[2];
+  struct lgr_uring_s *uring;
+
+  /* LGR_FLAGS_MMAP: records are copied into a mapped window of the file. */
+  int out_mmap;                /* 0 if current file couldn't be mapped. */
+  char *mmap_win;
+  uint64_t mmap_win_off;       /* File offset of mmap_win. */
+  uint64_t mmap_alloc_size;    /* Bytes preallocated (0 = not mapping). */
   int cur_out_wday;            /* 0=SUN..6=SAT. */
   unsigned int state;          /* See LGR_STATE_* constants above. */
   q_t *pool_q;
   q_t *log_q;
-  CPRT_SPIN_T log_lock;        /* Used unless LGR_FLAGS_NOLOCK. */
+  qm_t *pool_qm;               /* LGR_FLAGS_MPMC: replaces pool_q. */
+  qm_t *log_qm;                /* LGR_FLAGS_MPMC: replaces log_q. */
+
+  /* Size classes (see lgr_attr_t.class_msg_size): a pool per class replaces
+   * pool_q. A spare is a log taken but not used because its message didn't
+   * fit; it is only touched by lgr_log() (under log_lock). */
+  int num_classes;             /* 0 = not used. */
+  unsigned int class_msg_size[LGR_MAX_CLASSES];
+  q_t *class_pool_q[LGR_MAX_CLASSES];
+  lgr_log_t *class_spare[LGR_MAX_CLASSES];
+
+  /* Growable pool (see lgr_attr_t.pool_chunk_logs): chunks replace arena.
+   * Only the logger thread allocates and frees chunks, newest first. */
+  unsigned int pool_chunk_logs;  /* 0 = not used. */
+  unsigned int pool_shrink_ms;
+  unsigned int pool_logs;      /* Logs in all chunks. */
+  unsigned int pool_max_logs;  /* Stop growing here (q_size - 3). */
+  lgr_chunk_t *chunks;
+  int num_chunks;
+  unsigned int pool_peak;      /* Most logs in use this shrink window. */
+  struct cprt_timespec pool_window_ts;  /* Start of shrink window. */
+  lgr_log_t **pool_scratch;    /* q_size entries, for shrinking. */
+  uint64_t pool_overflows;     /* overflows_total sum at the last check. */
+  uint64_t pool_grows;
+  uint64_t pool_shrinks;
+
+  char *arena;                 /* All pool log buffers (or NULL). */
+  size_t arena_size;           /* Of arena or ring_buf. */
+  int arena_mapped;            /* 1 if MAP_HUGETLB mapping. */
+  CPRT_SPIN_T log_lock;        /* Used unless LGR_FLAGS_NOLOCK or MPMC. */
+
+  /* Logger thread placement (see lgr_attr_t). */
+  uint64_t cpu_mask;
+  int sched_policy;
+  int sched_priority;
+  char thread_name[16];        /* Empty = inherit. */
+  int numa_node;
+  volatile lgr_err_t thread_err;  /* Set if the thread couldn't start. */
+
+  unsigned int spin_us;        /* LGR_FLAGS_WAKEUP */
+  volatile int sleeping;       /* LGR_FLAGS_WAKEUP: logger thread is parked
+                                * (futex word). */
+
+  /* Blocking lgr_log() calls (see lgr_attr_t.block_us, lgr_log_block()). */
+  unsigned int block_us;       /* Default for lgr_log(). */
+  volatile int block_waiters;  /* Number of lgr_log() calls parked. */
+  volatile int free_seq;       /* Futex word; bumped when a log is freed. */
+  volatile uint64_t blocked_logs;      /* lgr_log() calls that waited. */
+  volatile uint64_t blocked_ns;        /* Total time spent waiting. */
+  volatile uint64_t blocked_timeouts;  /* Waits that ended in overflow. */
+
+  /* LGR_FLAGS_PER_THREAD: log_lock only protects thread registration. */
+  lgr_thread_t * volatile threads;  /* Registered app threads. */
+  CPRT_TLS_KEY_T thread_key;        /* Value is caller's lgr_thread_t. */
+
+  /* LGR_FLAGS_BYTE_RING: logs are carved out of ring_buf instead of
+   * being taken from pool_q. The "cnt" fields limit the number of logs in
+   * flight to what log_q can hold. */
+  uint8_t *ring_buf;
+  uint64_t ring_size;
+  uint64_t ring_tail;               /* Next free byte (app side). */
+  volatile uint64_t ring_head;      /* First byte in use (logger side). */
+  unsigned int ring_rec_max;        /* Bytes needed for a max-sized log. */
+  unsigned int ring_resv_cnt;       /* Logs reserved (app side). */
+  volatile unsigned int ring_rel_cnt;  /* Logs released (logger side). */
+
+  /* LGR_FLAGS_COALESCE: the last message written, and the run of repeats
+   * of it that have been counted instead of written (logger thread only). */
+  unsigned int coalesce_ms;
+  char *repeat_msg;            /* max_msg_size + 1 bytes (not terminated). */
+  int repeat_valid;            /* 0 = no message to compare with. */
+  uint64_t repeat_hash;
+  size_t repeat_len;
+  lgr_sev_t repeat_sev;
+  int repeat_trunc;
+  struct cprt_timeval repeat_first_tv;  /* Of the written copy. */
+  struct cprt_timeval repeat_last_tv;   /* Of the last repeat. */
+  struct cprt_timespec repeat_ts;       /* When the first repeat came. */
+  uint64_t repeat_cnt;         /* Repeats not yet summarized. */
+  uint64_t repeat_total;
+
+  char *fmt_buf;               /* LGR_FLAGS_DEFER_FMT: logger thread's
+                                * formatting buffer. */
+
+  /* LGR_FLAGS_BINARY: format strings already written to the current file
+   * (open-addressed hash table keyed by format pointer). */
+  const char **fmt_tbl;
+  uint32_t *fmt_tbl_ids;
+  unsigned int fmt_tbl_size;   /* Power of 2. */
+  unsigned int fmt_tbl_cnt;
+
+  /* Logger thread's time stamp caches (see lgr_ts_wday() and
+   * lgr_ts_render()). */
+  time_t ts_sec;               /* Second that ts_prefix is for. */
+  char ts_prefix[32];          /* "YYYY/MM/DD HH:MM:SS." */
+  int ts_prefix_len;
+  time_t ts_day_start;         /* Local midnight starting ts_wday. */
+  time_t ts_day_end;           /* Next local midnight. */
+  int ts_wday;
+
+  /* LGR_FLAGS_TSC_TS: logger thread's TSC to wall clock calibration. */
+  uint64_t tsc_ref;            /* TSC at usec_ref. */
+  int64_t usec_ref;            /* Wall clock, microseconds since epoch. */
+  double tsc_per_usec;
+  uint64_t tsc_base;           /* Start of tsc_per_usec measurement. */
+  int64_t usec_base;
+  uint64_t tsc_next_cal;       /* Recalibrate when the TSC passes this. */
 
   CPRT_SPIN_T overflow_lock;   /* Always used, even if LGR_FLAGS_NOLOCK. */
+  volatile lgr_sev_t min_sev;  /* See lgr_set_min_sev(). */
   unsigned int overflows[LGR_LAST_SEV + 1];  /* Number of queue overflows. */
+  unsigned int sev_reserve[LGR_LAST_SEV + 1];  /* See lgr_attr_t. */
   lgr_log_t overflow_log;      /* Dedicated log for queue overflow. */
   lgr_log_t quit_log;          /* Dedicated log for shutting down. */
   int overflow_log_available;  /* 0 = not available. */
 
   unsigned int file_size_drops[LGR_LAST_SEV + 1];
 
+  CPRT_SPIN_T site_lock;       /* Protects the sites list. */
+  lgr_site_t *sites;           /* Rate limited and sampled call sites. */
+  struct cprt_timespec site_window_ts;  /* Start of current window. */
+
+  /* Statistics (see lgr_get_stats()). Written only by the logger thread,
+   * except overflows_total (under overflow_lock). */
+  uint64_t logs_total;
+  uint64_t overflows_total[LGR_LAST_SEV + 1];
+  uint64_t file_size_drops_total[LGR_LAST_SEV + 1];
+  uint64_t suppressed_total;
+  unsigned int log_q_hwm;      /* LGR_FLAGS_STATS */
+  lgr_hist_t call_hist;        /* LGR_FLAGS_STATS */
+  lgr_hist_t queue_hist;       /* LGR_FLAGS_STATS */
+  lgr_hist_t write_hist;       /* LGR_FLAGS_STATS */
+
   CPRT_THREAD_T thread_id;
 };
 typedef struct lgr_s lgr_t;
 
 
-char *lgr_sev_str(lgr_sev_t lgr_sev);
+char *lgr_sev2str(lgr_sev_t lgr_sev);
 char *lgr_err2str(lgr_err_t lgr_err);
+void lgr_attr_init(lgr_attr_t *attr);
+lgr_err_t lgr_create_attr(lgr_t **rtn_lgr, lgr_attr_t *attr);
 lgr_err_t lgr_create(lgr_t **rtn_lgr, unsigned int max_msg_size,
     unsigned int q_size, unsigned int sleep_ms, uint32_t flags,
     char *file_prefix, int max_file_size_mb);
 lgr_err_t lgr_delete(lgr_t *lgr);
 lgr_err_t lgr_log(lgr_t *lgr, unsigned int severity, char *fmt, ...);
+lgr_err_t lgr_log_block(lgr_t *lgr, unsigned int block_us,
+    unsigned int severity, char *fmt, ...);
+lgr_err_t lgr_vlog(lgr_t *lgr, unsigned int block_us, unsigned int severity,
+    char *fmt, va_list args);
+lgr_err_t lgr_set_min_sev(lgr_t *lgr, lgr_sev_t min_sev);
+void lgr_site_register(lgr_t *lgr, lgr_site_t *site, lgr_sev_t severity,
+    unsigned int per_sec, unsigned int sample_n, const char *file, int line);
+lgr_err_t lgr_get_stats(lgr_t *lgr, lgr_stats_t *stats);
+uint64_t lgr_hist_pct(const lgr_hist_t *hist, double pct);
+
+/* Log only if "_sev" passes both the compile-time floor and the lgr's
+ * minimum severity. Otherwise, the cost is a load and a branch, and the
+ * remaining arguments are not evaluated. Returns the lgr_log() status, or
+ * LGR_ERR_OK if filtered. */
+#define LGR_LOG(_lgr, _sev, ...) \
+  (((_sev) >= LGR_MIN_SEV_COMPILED && (_sev) >= (_lgr)->min_sev) \
+    ? lgr_log((_lgr), (_sev), __VA_ARGS__) : LGR_ERR_OK)
+
+/* Log at most "_per_sec" messages per second from this call site. The rest
+ * are counted and reported periodically by the logger thread. The lgr_log()
+ * return status is discarded. */
+#define LGR_LOG_RATELIMITED(_lgr, _sev, _per_sec, ...) do { \
+  static lgr_site_t lgr_site_; \
+  if (lgr_site_.lgr != (_lgr)) { \
+    lgr_site_register((_lgr), &lgr_site_, (_sev), (_per_sec), 0, \
+        __FILE__, __LINE__); \
+  } \
+  if (CPRT_ATOMIC_INC_RELAXED(&lgr_site_.cnt) <= lgr_site_.per_sec) { \
+    (void)lgr_log((_lgr), (_sev), __VA_ARGS__); \
+  } \
+} while (0)
+
+/* Log only 1 in "_sample_n" messages from this call site. */
+#define LGR_LOG_SAMPLED(_lgr, _sev, _sample_n, ...) do { \
+  static lgr_site_t lgr_site_; \
+  if (lgr_site_.lgr != (_lgr)) { \
+    lgr_site_register((_lgr), &lgr_site_, (_sev), 0, (_sample_n), \
+        __FILE__, __LINE__); \
+  } \
+  if ((CPRT_ATOMIC_INC_RELAXED(&lgr_site_.cnt) - 1) % lgr_site_.sample_n == 0) { \
+    (void)lgr_log((_lgr), (_sev), __VA_ARGS__); \
+  } \
+} while (0)
 
 #if defined(__cplusplus)
 }
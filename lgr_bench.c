@@ -0,0 +1,322 @@
+/* lgr_bench.c - lgr_log() latency and throughput benchmark. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/lgr
+ */
+
+/* Usage: lgr_bench [-h] [-n logs] [-t threads] [-m msg_sizes] [-q q_sizes]
+ *                  [-f modes] [-p file_prefix]
+ * Each of -t, -m, -q, and -f takes a comma-separated list, and every
+ * combination is run. For each, "threads" producer threads each call
+ * lgr_log() "logs" times as fast as they can, timing every call with
+ * CPRT_GETTIME. One CSV line is written to stdout per combination (see
+ * usage() for the columns). */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#if ! defined(_WIN32)
+  #include <stdlib.h>
+  #include <time.h>
+  #include <unistd.h>
+  #include <sys/time.h>
+#endif
+
+#include "cprt.h"
+#include "lgr.h"
+
+
+#define MAX_LIST 16
+
+struct mode_s {
+  char *name;
+  uint32_t flags;
+};
+static struct mode_s modes[] = {
+  { "lock", 0 },
+  { "nolock", LGR_FLAGS_NOLOCK },
+  { "defer_ts", LGR_FLAGS_DEFER_TS },
+  { "nolock_defer_ts", LGR_FLAGS_NOLOCK | LGR_FLAGS_DEFER_TS },
+  { NULL, 0 }
+};
+
+/* Options. */
+static int o_logs = 10000;
+static char *o_prefix = "x.";
+
+/* Shared with the producer threads. */
+static lgr_t *bench_lgr;
+static char *bench_msg;
+static volatile int bench_go;
+
+struct producer_s {
+  CPRT_THREAD_T thread_id;
+  uint64_t *lat_ns;      /* Duration of each lgr_log() call. */
+  int overflows;         /* lgr_log() calls that returned LGR_ERR_QFULL. */
+  struct cprt_timespec start_ts;
+  struct cprt_timespec end_ts;
+};
+typedef struct producer_s producer_t;
+
+
+static void usage(char *msg)
+{
+  if (msg) fprintf(stderr, "\n%s\n\n", msg);
+  fprintf(stderr, "Usage: lgr_bench [-h] [-n logs] [-t threads] "
+      "[-m msg_sizes] [-q q_sizes] [-f modes] [-p file_prefix]\n"
+      "where:\n"
+      "  -h : help.\n"
+      "  -n logs : lgr_log() calls per thread (default 10000).\n"
+      "  -t threads : producer thread counts (default 1,2,4).\n"
+      "  -m msg_sizes : message lengths in bytes (default 16,128).\n"
+      "  -q q_sizes : lgr q_size values (default 1024,16384).\n"
+      "  -f modes : lock, nolock, defer_ts, nolock_defer_ts\n"
+      "             (default all; nolock only runs with 1 thread).\n"
+      "  -p file_prefix : log file prefix (default x.).\n"
+      "Output is CSV, one line per combination:\n"
+      "  threads,msg_size,q_size,mode,logs,overflows,"
+      "mean_ns,p50_ns,p99_ns,p999_ns,max_ns,logs_per_sec\n"
+      "Latencies are of accepted logs; overflowed calls are only counted.\n");
+  exit(1);
+}  /* usage */
+
+
+/* Parse comma-separated positive integers. Returns number of values. */
+static int parse_list(char *str, int *vals)
+{
+  char *copy = strdup(str);
+  char *tok, *save;
+  int n = 0;
+
+  CPRT_ENULL(copy);
+  for (tok = strtok_r(copy, ",", &save); tok != NULL;
+      tok = strtok_r(NULL, ",", &save)) {
+    if (n == MAX_LIST) usage("Too many values in list");
+    CPRT_ATOI(tok, vals[n]);
+    if (vals[n] <= 0) usage("Values must be > 0");
+    n++;
+  }
+  free(copy);
+  return n;
+}  /* parse_list */
+
+
+/* Parse comma-separated mode names. Returns number of modes. */
+static int parse_modes(char *str, int *mode_idx)
+{
+  char *copy = strdup(str);
+  char *tok, *save;
+  int n = 0;
+  int i;
+
+  CPRT_ENULL(copy);
+  for (tok = strtok_r(copy, ",", &save); tok != NULL;
+      tok = strtok_r(NULL, ",", &save)) {
+    if (n == MAX_LIST) usage("Too many modes");
+    for (i = 0; modes[i].name != NULL; i++) {
+      if (strcmp(tok, modes[i].name) == 0) break;
+    }
+    if (modes[i].name == NULL) usage("Unknown mode");
+    mode_idx[n++] = i;
+  }
+  free(copy);
+  return n;
+}  /* parse_modes */
+
+
+static uint64_t ts_ns(struct cprt_timespec *ts)
+{
+  return (uint64_t)ts->tv_sec * 1000000000 + (uint64_t)ts->tv_nsec;
+}  /* ts_ns */
+
+
+CPRT_THREAD_ENTRYPOINT producer_thread(void *in_arg)
+{
+  producer_t *prod = (producer_t *)in_arg;
+  struct cprt_timespec t0, t1;
+  int i, n;
+
+  while (! bench_go) {
+    CPRT_CPU_PAUSE();
+  }
+
+  n = 0;
+  CPRT_GETTIME(&(prod->start_ts));
+  for (i = 0; i < o_logs; i++) {
+    lgr_err_t err;
+
+    CPRT_GETTIME(&t0);
+    err = lgr_log(bench_lgr, LGR_SEV_FYI, "%s", bench_msg);
+    CPRT_GETTIME(&t1);
+    if (err == LGR_ERR_OK) {
+      CPRT_DIFF_TS(prod->lat_ns[n], t1, t0);
+      n++;
+    }
+    else {
+      CPRT_ASSERT(err == LGR_ERR_QFULL);
+      prod->overflows++;
+    }
+  }
+  CPRT_GETTIME(&(prod->end_ts));
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* producer_thread */
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t va = *(const uint64_t *)a;
+  uint64_t vb = *(const uint64_t *)b;
+  return (va < vb) ? -1 : (va > vb);
+}  /* cmp_u64 */
+
+
+static uint64_t pct(uint64_t *sorted, int n, double p)
+{
+  int i;
+
+  if (n == 0) return 0;
+  i = (int)((double)n * p / 100.0);
+  if (i >= n) i = n - 1;
+  return sorted[i];
+}  /* pct */
+
+
+static void run_one(int num_threads, int msg_size, int q_size, int mode)
+{
+  lgr_attr_t attr;
+  producer_t *prods;
+  uint64_t *all_lat;
+  uint64_t sum_ns, start_ns, end_ns;
+  int num_lat, overflows;
+  lgr_err_t err;
+  int i, j;
+
+  lgr_attr_init(&attr);
+  attr.max_msg_size = msg_size;
+  attr.q_size = q_size;
+  attr.flags = modes[mode].flags;
+  attr.file_prefix = o_prefix;
+  attr.max_file_size_mb = 1024;
+  err = lgr_create_attr(&bench_lgr, &attr);
+  if (err != LGR_ERR_OK) {
+    fprintf(stderr, "lgr_bench: lgr_create_attr(q_size=%d, msg_size=%d): "
+        "%s\n", q_size, msg_size, lgr_err2str(err));
+    exit(1);
+  }
+
+  bench_msg = (char *)malloc(msg_size + 1);
+  CPRT_ENULL(bench_msg);
+  memset(bench_msg, 'x', msg_size);
+  bench_msg[msg_size] = '\0';
+
+  prods = (producer_t *)calloc(num_threads, sizeof(producer_t));
+  CPRT_ENULL(prods);
+  bench_go = 0;
+  for (i = 0; i < num_threads; i++) {
+    prods[i].lat_ns = (uint64_t *)malloc(o_logs * sizeof(uint64_t));
+    CPRT_ENULL(prods[i].lat_ns);
+    CPRT_THREAD_CREATE(prods[i].thread_id, producer_thread, &prods[i]);
+  }
+  CPRT_SLEEP_MS(10);  /* Let the threads get to the start line. */
+  bench_go = 1;
+  for (i = 0; i < num_threads; i++) {
+    CPRT_THREAD_JOIN(prods[i].thread_id);
+  }
+  CPRT_ASSERT(lgr_delete(bench_lgr) == LGR_ERR_OK);
+
+  /* Merge. */
+  all_lat = (uint64_t *)malloc((size_t)num_threads * o_logs * sizeof(uint64_t));
+  CPRT_ENULL(all_lat);
+  num_lat = 0;
+  overflows = 0;
+  sum_ns = 0;
+  start_ns = UINT64_MAX;
+  end_ns = 0;
+  for (i = 0; i < num_threads; i++) {
+    int accepted = o_logs - prods[i].overflows;
+
+    for (j = 0; j < accepted; j++) {
+      all_lat[num_lat++] = prods[i].lat_ns[j];
+      sum_ns += prods[i].lat_ns[j];
+    }
+    overflows += prods[i].overflows;
+    if (ts_ns(&prods[i].start_ts) < start_ns) {
+      start_ns = ts_ns(&prods[i].start_ts);
+    }
+    if (ts_ns(&prods[i].end_ts) > end_ns) {
+      end_ns = ts_ns(&prods[i].end_ts);
+    }
+    free(prods[i].lat_ns);
+  }
+  qsort(all_lat, num_lat, sizeof(uint64_t), cmp_u64);
+
+  printf("%d,%d,%d,%s,%d,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+      ",%" PRIu64 ",%.0f\n",
+      num_threads, msg_size, q_size, modes[mode].name, num_lat, overflows,
+      (num_lat > 0) ? sum_ns / num_lat : 0,
+      pct(all_lat, num_lat, 50), pct(all_lat, num_lat, 99),
+      pct(all_lat, num_lat, 99.9), (num_lat > 0) ? all_lat[num_lat - 1] : 0,
+      (end_ns > start_ns)
+        ? (double)num_lat * 1e9 / (double)(end_ns - start_ns) : 0.0);
+  fflush(stdout);
+
+  free(all_lat);
+  free(prods);
+  free(bench_msg);
+}  /* run_one */
+
+
+int main(int argc, char **argv)
+{
+  int threads[MAX_LIST], msg_sizes[MAX_LIST], q_sizes[MAX_LIST];
+  int mode_idx[MAX_LIST];
+  int num_threads, num_msg_sizes, num_q_sizes, num_modes;
+  int opt;
+  int t, m, q, f;
+
+  num_threads = parse_list("1,2,4", threads);
+  num_msg_sizes = parse_list("16,128", msg_sizes);
+  num_q_sizes = parse_list("1024,16384", q_sizes);
+  num_modes = parse_modes("lock,nolock,defer_ts,nolock_defer_ts", mode_idx);
+
+  while ((opt = cprt_getopt(argc, argv, "hn:t:m:q:f:p:")) != EOF) {
+    switch (opt) {
+      case 'h': usage(NULL); break;
+      case 'n': CPRT_ATOI(cprt_optarg, o_logs); break;
+      case 't': num_threads = parse_list(cprt_optarg, threads); break;
+      case 'm': num_msg_sizes = parse_list(cprt_optarg, msg_sizes); break;
+      case 'q': num_q_sizes = parse_list(cprt_optarg, q_sizes); break;
+      case 'f': num_modes = parse_modes(cprt_optarg, mode_idx); break;
+      case 'p': o_prefix = cprt_optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (o_logs <= 0) usage("logs must be > 0");
+  if (cprt_optind != argc) usage("Unexpected positional parameter");
+
+  printf("threads,msg_size,q_size,mode,logs,overflows,"
+      "mean_ns,p50_ns,p99_ns,p999_ns,max_ns,logs_per_sec\n");
+  for (t = 0; t < num_threads; t++) {
+    for (m = 0; m < num_msg_sizes; m++) {
+      for (q = 0; q < num_q_sizes; q++) {
+        for (f = 0; f < num_modes; f++) {
+          if ((modes[mode_idx[f]].flags & LGR_FLAGS_NOLOCK)
+              && threads[t] > 1) {
+            continue;  /* NOLOCK is only safe with one producer. */
+          }
+          run_one(threads[t], msg_sizes[m], q_sizes[q], mode_idx[f]);
+        }
+      }
+    }
+  }
+
+  return 0;
+}  /* main */
@@ -0,0 +1,182 @@
+/* lgr_decode.c - convert binary lgr log files to text. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/lgr
+ */
+
+/* Usage: lgr_decode [file ...]
+ * Reads binary log files written with LGR_FLAGS_BINARY (stdin if no files
+ * are given) and writes the same text that lgr would have written without
+ * LGR_FLAGS_BINARY to stdout. Time stamps are converted using the local
+ * time zone of the decoding process. */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#if ! defined(_WIN32)
+  #include <stdlib.h>
+  #include <time.h>
+  #include <unistd.h>
+  #include <sys/time.h>
+#endif
+
+#include "cprt.h"
+#include "lgr.h"
+#include "lgr_fmt.h"
+
+
+/* Format strings of the current file, indexed by fmt_id. */
+static char **fmts = NULL;
+static unsigned int fmts_size = 0;
+
+
+static void print_line(lgr_bin_rec_hdr_t *rec, const char *msg,
+    const char *msg_suffix)
+{
+  time_t tv_sec = (time_t)rec->tv_sec;
+  struct tm tm_buf;
+
+  CPRT_LOCALTIME_R(&tv_sec, &tm_buf);  /* Parse time stamp. */
+  printf("%04d/%02d/%02d %02d:%02d:%02d.%06d %s %s%s\n",
+      tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
+      tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec,
+      (int)rec->tv_usec, lgr_sev2str(rec->severity), msg, msg_suffix);
+}  /* print_line */
+
+
+/* Returns 0 on success, 1 on bad or truncated file. */
+static int decode_file(FILE *fp, const char *fname)
+{
+  lgr_bin_file_hdr_t hdr;
+  lgr_bin_rec_hdr_t rec;
+  char *payload = NULL;
+  unsigned int payload_size = 0;
+  char *msg_buf;
+  unsigned int i;
+
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+      || memcmp(hdr.magic, LGR_BIN_MAGIC, sizeof(hdr.magic)) != 0) {
+    fprintf(stderr, "lgr_decode: %s: not a binary lgr file\n", fname);
+    return 1;
+  }
+  if (hdr.byte_order != LGR_BIN_BYTE_ORDER
+      || hdr.version < 1 || hdr.version > LGR_BIN_VERSION
+      || hdr.file_hdr_size != sizeof(lgr_bin_file_hdr_t)
+      || hdr.rec_hdr_size != sizeof(lgr_bin_rec_hdr_t)
+      || hdr.ptr_size != sizeof(void *)
+      || hdr.long_double_size != sizeof(long double)) {
+    fprintf(stderr, "lgr_decode: %s: written by incompatible lgr or host "
+        "(version %u)\n", fname, hdr.version);
+    return 1;
+  }
+
+  /* Leave room for NUL and truncate test, same as the logger. */
+  msg_buf = (char *)malloc(hdr.max_msg_size + 2);
+  CPRT_ENULL(msg_buf);
+
+  /* Format ids are per file. */
+  for (i = 0; i < fmts_size; i++) {
+    free(fmts[i]);
+    fmts[i] = NULL;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+    unsigned int payload_len;
+
+    if (rec.rec_len < sizeof(rec)) {
+      fprintf(stderr, "lgr_decode: %s: bad record length %u\n", fname,
+          rec.rec_len);
+      free(payload); free(msg_buf);
+      return 1;
+    }
+    payload_len = rec.rec_len - sizeof(rec);
+    if (payload_len + 1 > payload_size) {
+      payload_size = payload_len + 1;
+      payload = (char *)realloc(payload, payload_size);
+      CPRT_ENULL(payload);
+    }
+    if (payload_len > 0 && fread(payload, 1, payload_len, fp) != payload_len) {
+      fprintf(stderr, "lgr_decode: %s: truncated record\n", fname);
+      free(payload); free(msg_buf);
+      return 1;
+    }
+    payload[payload_len] = '\0';
+    if (hdr.version < 2) {
+      rec.severity += LGR_SEV_FYI;  /* Version 1 had no TRACE or DEBUG. */
+    }
+
+    if (rec.rec_type == LGR_BIN_REC_TEXT) {
+      print_line(&rec, payload,
+          (rec.flags & LGR_BIN_FLAG_TRUNC) ? LGR_TRUNC_SUFFIX : "");
+    }
+    else if (rec.rec_type == LGR_BIN_REC_FMT) {
+      if (rec.fmt_id >= fmts_size) {
+        unsigned int new_size = (rec.fmt_id + 1) * 2;
+        fmts = (char **)realloc(fmts, new_size * sizeof(char *));
+        CPRT_ENULL(fmts);
+        for (i = fmts_size; i < new_size; i++) {
+          fmts[i] = NULL;
+        }
+        fmts_size = new_size;
+      }
+      free(fmts[rec.fmt_id]);
+      fmts[rec.fmt_id] = strdup(payload);
+      CPRT_ENULL(fmts[rec.fmt_id]);
+    }
+    else if (rec.rec_type == LGR_BIN_REC_PACKED) {
+      int msg_len = -1;
+
+      if (rec.fmt_id < fmts_size && fmts[rec.fmt_id] != NULL) {
+        msg_len = lgr_fmt_render(msg_buf, hdr.max_msg_size + 2,
+            fmts[rec.fmt_id], payload, payload_len);
+      }
+      if (msg_len < 0) {
+        print_line(&rec, "lgr: bad deferred log args", "");
+      }
+      else if (msg_len > hdr.max_msg_size) {
+        msg_buf[hdr.max_msg_size] = '\0';
+        print_line(&rec, msg_buf, LGR_TRUNC_SUFFIX);
+      }
+      else {
+        print_line(&rec, msg_buf, "");
+      }
+    }
+    else {
+      fprintf(stderr, "lgr_decode: %s: skipping unknown record type %u\n",
+          fname, (unsigned int)rec.rec_type);
+    }
+  }
+
+  free(payload);
+  free(msg_buf);
+  return 0;
+}  /* decode_file */
+
+
+int main(int argc, char **argv)
+{
+  int errs = 0;
+  int i;
+
+  if (argc < 2) {
+    errs += decode_file(stdin, "stdin");
+  }
+  for (i = 1; i < argc; i++) {
+    FILE *fp = fopen(argv[i], "rb");
+    if (fp == NULL) {
+      perror(argv[i]);
+      errs++;
+      continue;
+    }
+    errs += decode_file(fp, argv[i]);
+    fclose(fp);
+  }
+
+  return (errs == 0) ? 0 : 1;
+}  /* main */
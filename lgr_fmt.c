@@ -0,0 +1,449 @@
+/* lgr_fmt.c - deferred printf-style formatting for lgr. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/lgr
+ */
+
+/* The application thread calls lgr_fmt_pack() to save the raw argument
+ * values, and the logger thread calls lgr_fmt_render() to format them.
+ * Since C has no portable way to build a va_list, rendering is done one
+ * conversion at a time, each with its own snprintf() call.
+ *
+ * Packed layout, in argument order (no alignment, always memcpy'ed):
+ *   '*' width/precision - int (4 bytes).
+ *   integer, %c         - 64-bit value (8 bytes).
+ *   floating point      - double, or long double for "%L".
+ *   %p                  - void pointer.
+ *   %s                  - uint32 length (0xffffffff = NULL), chars, NUL.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "lgr_fmt.h"
+
+/* Length modifiers. */
+#define LGR_FMT_LEN_NONE 0
+#define LGR_FMT_LEN_HH 1
+#define LGR_FMT_LEN_H 2
+#define LGR_FMT_LEN_L 3
+#define LGR_FMT_LEN_LL 4
+#define LGR_FMT_LEN_J 5
+#define LGR_FMT_LEN_Z 6
+#define LGR_FMT_LEN_T 7
+#define LGR_FMT_LEN_BIGL 8
+
+/* Argument kinds. */
+#define LGR_FMT_KIND_PCT 0   /* "%%", no argument. */
+#define LGR_FMT_KIND_INT 1
+#define LGR_FMT_KIND_UINT 2
+#define LGR_FMT_KIND_DBL 3
+#define LGR_FMT_KIND_STR 4
+#define LGR_FMT_KIND_PTR 5
+
+/* Star value meaning "no precision". */
+#define LGR_FMT_NO_PREC -1
+
+/* One parsed conversion specification. */
+struct lgr_fmt_spec_s {
+  const char *flags;      /* Flag chars, not NUL-terminated. */
+  int flags_len;
+  const char *width;      /* Width digits (if not star). */
+  int width_len;
+  int width_star;
+  const char *prec;       /* Precision digits (if not star), after '.'. */
+  int prec_len;
+  int has_prec;
+  int prec_star;
+  int len_mod;            /* LGR_FMT_LEN_* */
+  int kind;               /* LGR_FMT_KIND_* */
+  char conv;              /* Conversion character. */
+};
+typedef struct lgr_fmt_spec_s lgr_fmt_spec_t;
+
+static char *lgr_fmt_len_strs[] = {
+  "", "hh", "h", "l", "ll", "j", "z", "t", "L" };
+
+
+/* Parse the conversion spec starting at "p" (which points at '%').
+ * Returns pointer just past the spec, or NULL if unsupported. */
+static const char *lgr_fmt_parse(const char *p, lgr_fmt_spec_t *spec)
+{
+  p++;  /* Skip '%'. */
+  memset(spec, 0, sizeof(*spec));
+
+  spec->flags = p;
+  while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+    p++;
+  }
+  spec->flags_len = (int)(p - spec->flags);
+
+  if (*p == '*') {
+    spec->width_star = 1;
+    p++;
+  }
+  else {
+    spec->width = p;
+    while (*p >= '0' && *p <= '9') {
+      p++;
+    }
+    spec->width_len = (int)(p - spec->width);
+  }
+  if (*p == '$') {
+    return NULL;  /* Positional args not supported. */
+  }
+
+  if (*p == '.') {
+    p++;
+    spec->has_prec = 1;
+    if (*p == '*') {
+      spec->prec_star = 1;
+      p++;
+    }
+    else {
+      spec->prec = p;
+      while (*p >= '0' && *p <= '9') {
+        p++;
+      }
+      spec->prec_len = (int)(p - spec->prec);
+    }
+  }
+
+  switch (*p) {
+    case 'h':
+      if (p[1] == 'h') { spec->len_mod = LGR_FMT_LEN_HH; p += 2; }
+      else { spec->len_mod = LGR_FMT_LEN_H; p++; }
+      break;
+    case 'l':
+      if (p[1] == 'l') { spec->len_mod = LGR_FMT_LEN_LL; p += 2; }
+      else { spec->len_mod = LGR_FMT_LEN_L; p++; }
+      break;
+    case 'q': spec->len_mod = LGR_FMT_LEN_LL; p++; break;
+    case 'j': spec->len_mod = LGR_FMT_LEN_J; p++; break;
+    case 'z': spec->len_mod = LGR_FMT_LEN_Z; p++; break;
+    case 't': spec->len_mod = LGR_FMT_LEN_T; p++; break;
+    case 'L': spec->len_mod = LGR_FMT_LEN_BIGL; p++; break;
+    default: break;
+  }
+
+  spec->conv = *p;
+  switch (*p) {
+    case '%':
+      spec->kind = LGR_FMT_KIND_PCT;
+      break;
+    case 'd': case 'i':
+      spec->kind = LGR_FMT_KIND_INT;
+      break;
+    case 'o': case 'u': case 'x': case 'X':
+      spec->kind = LGR_FMT_KIND_UINT;
+      break;
+    case 'c':
+      if (spec->len_mod != LGR_FMT_LEN_NONE) { return NULL; }  /* wint_t */
+      spec->kind = LGR_FMT_KIND_INT;
+      break;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+      spec->kind = LGR_FMT_KIND_DBL;
+      break;
+    case 's':
+      if (spec->len_mod != LGR_FMT_LEN_NONE) { return NULL; }  /* wchar_t */
+      spec->kind = LGR_FMT_KIND_STR;
+      break;
+    case 'p':
+      spec->kind = LGR_FMT_KIND_PTR;
+      break;
+    default:
+      return NULL;  /* Includes "%n" and end of string. */
+  }
+
+  return p + 1;
+}  /* lgr_fmt_parse */
+
+
+/* Append "_n" bytes at "_p" to the packed buffer, or fail. */
+#define LGR_FMT_PUT(_p, _n) do { \
+  if (used + (int)(_n) > buf_size) { return -1; } \
+  memcpy(&buf[used], (_p), (_n)); \
+  used += (int)(_n); \
+} while (0)
+
+/* See lgr_fmt.h for doc. */
+int lgr_fmt_pack(char *buf, int buf_size, const char *fmt, va_list args,
+    int str_max)
+{
+  lgr_fmt_spec_t spec;
+  const char *p = fmt;
+  int used = 0;
+
+  while ((p = strchr(p, '%')) != NULL) {
+    int prec = -1;  /* -1 = no precision. */
+
+    p = lgr_fmt_parse(p, &spec);
+    if (p == NULL) { return -1; }
+
+    if (spec.width_star) {
+      int star = va_arg(args, int);
+      LGR_FMT_PUT(&star, sizeof(star));
+    }
+    if (spec.prec_star) {
+      int star = va_arg(args, int);
+      LGR_FMT_PUT(&star, sizeof(star));
+      prec = (star >= 0) ? star : -1;  /* Negative is no precision. */
+    }
+    else if (spec.has_prec) {
+      int i;
+      prec = 0;  /* "." alone is precision 0. */
+      for (i = 0; i < spec.prec_len && prec <= str_max; i++) {
+        prec = prec * 10 + (spec.prec[i] - '0');
+      }
+    }
+
+    switch (spec.kind) {
+      case LGR_FMT_KIND_PCT:
+        break;
+
+      case LGR_FMT_KIND_INT: {
+        int64_t v;
+        switch (spec.len_mod) {
+          case LGR_FMT_LEN_L: v = va_arg(args, long); break;
+          case LGR_FMT_LEN_LL: v = va_arg(args, long long); break;
+          case LGR_FMT_LEN_J: v = va_arg(args, intmax_t); break;
+          case LGR_FMT_LEN_Z: v = (int64_t)va_arg(args, size_t); break;
+          case LGR_FMT_LEN_T: v = va_arg(args, ptrdiff_t); break;
+          default: v = va_arg(args, int); break;  /* hh, h promoted. */
+        }
+        LGR_FMT_PUT(&v, sizeof(v));
+        break;
+      }
+
+      case LGR_FMT_KIND_UINT: {
+        uint64_t v;
+        switch (spec.len_mod) {
+          case LGR_FMT_LEN_L: v = va_arg(args, unsigned long); break;
+          case LGR_FMT_LEN_LL: v = va_arg(args, unsigned long long); break;
+          case LGR_FMT_LEN_J: v = va_arg(args, uintmax_t); break;
+          case LGR_FMT_LEN_Z: v = va_arg(args, size_t); break;
+          case LGR_FMT_LEN_T: v = (uint64_t)va_arg(args, ptrdiff_t); break;
+          default: v = va_arg(args, unsigned int); break;
+        }
+        LGR_FMT_PUT(&v, sizeof(v));
+        break;
+      }
+
+      case LGR_FMT_KIND_DBL:
+        if (spec.len_mod == LGR_FMT_LEN_BIGL) {
+          long double v = va_arg(args, long double);
+          LGR_FMT_PUT(&v, sizeof(v));
+        }
+        else {
+          double v = va_arg(args, double);
+          LGR_FMT_PUT(&v, sizeof(v));
+        }
+        break;
+
+      case LGR_FMT_KIND_STR: {
+        const char *s = va_arg(args, const char *);
+        uint32_t len;
+        if (s == NULL) {
+          len = 0xffffffff;
+          LGR_FMT_PUT(&len, sizeof(len));
+        }
+        else {
+          /* Like printf, read no more than the precision; the string
+           * need not be NUL terminated within it. */
+          uint32_t max = (prec >= 0 && prec < str_max)
+              ? (uint32_t)prec : (uint32_t)str_max;
+          len = 0;
+          while (len < max && s[len] != '\0') {
+            len++;
+          }
+          LGR_FMT_PUT(&len, sizeof(len));
+          LGR_FMT_PUT(s, len);
+          LGR_FMT_PUT("", 1);
+        }
+        break;
+      }
+
+      case LGR_FMT_KIND_PTR: {
+        void *v = va_arg(args, void *);
+        LGR_FMT_PUT(&v, sizeof(v));
+        break;
+      }
+    }
+  }
+
+  return used;
+}  /* lgr_fmt_pack */
+
+
+/* Copy "_n" bytes from the packed args into "_p", or fail. */
+#define LGR_FMT_GET(_p, _n) do { \
+  if (pos + (int)(_n) > packed_len) { return -1; } \
+  memcpy((_p), &packed[pos], (_n)); \
+  pos += (int)(_n); \
+} while (0)
+
+/* Format one conversion at the current output position. */
+#define LGR_FMT_ONE(_v) do { \
+  int remain_ = (len < buf_size) ? (buf_size - len) : 0; \
+  int n_; \
+  if (width_star && prec_star) { \
+    n_ = snprintf(remain_ ? &buf[len] : NULL, remain_, spec_str, width, prec, _v); \
+  } else if (width_star) { \
+    n_ = snprintf(remain_ ? &buf[len] : NULL, remain_, spec_str, width, _v); \
+  } else if (prec_star) { \
+    n_ = snprintf(remain_ ? &buf[len] : NULL, remain_, spec_str, prec, _v); \
+  } else { \
+    n_ = snprintf(remain_ ? &buf[len] : NULL, remain_, spec_str, _v); \
+  } \
+  if (n_ < 0) { return -1; } \
+  len += n_; \
+} while (0)
+
+/* See lgr_fmt.h for doc. */
+int lgr_fmt_render(char *buf, int buf_size, const char *fmt,
+    const char *packed, int packed_len)
+{
+  lgr_fmt_spec_t spec;
+  char spec_str[64];
+  const char *p = fmt;
+  int len = 0;
+  int pos = 0;
+
+  while (*p != '\0') {
+    int width = 0, prec = 0;
+    int width_star, prec_star;
+    int spec_len;
+
+    if (*p != '%') {
+      if (len < buf_size - 1) {
+        buf[len] = *p;
+      }
+      len++;
+      p++;
+      continue;
+    }
+
+    p = lgr_fmt_parse(p, &spec);
+    if (p == NULL) { return -1; }
+    if (spec.kind == LGR_FMT_KIND_PCT) {
+      if (len < buf_size - 1) {
+        buf[len] = '%';
+      }
+      len++;
+      continue;
+    }
+
+    /* Rebuild the conversion spec. Star values are passed to snprintf()
+     * as args, same as the original call. */
+    width_star = spec.width_star;
+    prec_star = spec.prec_star;
+    if (width_star) { LGR_FMT_GET(&width, sizeof(width)); }
+    if (prec_star) { LGR_FMT_GET(&prec, sizeof(prec)); }
+    if (spec.flags_len + spec.width_len + spec.prec_len + 8 > sizeof(spec_str)) {
+      return -1;
+    }
+    spec_len = 0;
+    spec_str[spec_len++] = '%';
+    memcpy(&spec_str[spec_len], spec.flags, spec.flags_len);
+    spec_len += spec.flags_len;
+    if (width_star) {
+      spec_str[spec_len++] = '*';
+    }
+    else {
+      memcpy(&spec_str[spec_len], spec.width, spec.width_len);
+      spec_len += spec.width_len;
+    }
+    if (spec.has_prec) {
+      spec_str[spec_len++] = '.';
+      if (prec_star) {
+        spec_str[spec_len++] = '*';
+      }
+      else {
+        memcpy(&spec_str[spec_len], spec.prec, spec.prec_len);
+        spec_len += spec.prec_len;
+      }
+    }
+    strcpy(&spec_str[spec_len], lgr_fmt_len_strs[spec.len_mod]);
+    spec_len += (int)strlen(lgr_fmt_len_strs[spec.len_mod]);
+    spec_str[spec_len++] = spec.conv;
+    spec_str[spec_len] = '\0';
+
+    switch (spec.kind) {
+      case LGR_FMT_KIND_INT: {
+        int64_t v;
+        LGR_FMT_GET(&v, sizeof(v));
+        switch (spec.len_mod) {
+          case LGR_FMT_LEN_L: LGR_FMT_ONE((long)v); break;
+          case LGR_FMT_LEN_LL: LGR_FMT_ONE((long long)v); break;
+          case LGR_FMT_LEN_J: LGR_FMT_ONE((intmax_t)v); break;
+          case LGR_FMT_LEN_Z: LGR_FMT_ONE((size_t)v); break;
+          case LGR_FMT_LEN_T: LGR_FMT_ONE((ptrdiff_t)v); break;
+          default: LGR_FMT_ONE((int)v); break;
+        }
+        break;
+      }
+
+      case LGR_FMT_KIND_UINT: {
+        uint64_t v;
+        LGR_FMT_GET(&v, sizeof(v));
+        switch (spec.len_mod) {
+          case LGR_FMT_LEN_L: LGR_FMT_ONE((unsigned long)v); break;
+          case LGR_FMT_LEN_LL: LGR_FMT_ONE((unsigned long long)v); break;
+          case LGR_FMT_LEN_J: LGR_FMT_ONE((uintmax_t)v); break;
+          case LGR_FMT_LEN_Z: LGR_FMT_ONE((size_t)v); break;
+          case LGR_FMT_LEN_T: LGR_FMT_ONE((ptrdiff_t)v); break;
+          default: LGR_FMT_ONE((unsigned int)v); break;
+        }
+        break;
+      }
+
+      case LGR_FMT_KIND_DBL:
+        if (spec.len_mod == LGR_FMT_LEN_BIGL) {
+          long double v;
+          LGR_FMT_GET(&v, sizeof(v));
+          LGR_FMT_ONE(v);
+        }
+        else {
+          double v;
+          LGR_FMT_GET(&v, sizeof(v));
+          LGR_FMT_ONE(v);
+        }
+        break;
+
+      case LGR_FMT_KIND_STR: {
+        uint32_t s_len;
+        const char *s = NULL;
+        LGR_FMT_GET(&s_len, sizeof(s_len));
+        if (s_len != 0xffffffff) {
+          if (pos + (int)s_len + 1 > packed_len) { return -1; }
+          s = &packed[pos];
+          pos += s_len + 1;
+        }
+        LGR_FMT_ONE(s);
+        break;
+      }
+
+      case LGR_FMT_KIND_PTR: {
+        void *v;
+        LGR_FMT_GET(&v, sizeof(v));
+        LGR_FMT_ONE(v);
+        break;
+      }
+    }
+  }
+
+  if (buf_size > 0) {
+    buf[(len < buf_size) ? len : (buf_size - 1)] = '\0';
+  }
+  return len;
+}  /* lgr_fmt_render */
@@ -0,0 +1,44 @@
+/* lgr_fmt.h - deferred printf-style formatting for lgr. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/lgr
+ */
+
+#ifndef LGR_FMT_H
+#define LGR_FMT_H
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int lgr_fmt_pack(char *buf, int buf_size, const char *fmt, va_list args,
+    int str_max);
+/* Copy the raw argument values for "fmt" into "buf", without formatting.
+ * The argument kinds are taken from parsing "fmt". Strings are copied by
+ * value (at most "str_max" characters of each; more can never show up in a
+ * message truncated to str_max - 1 characters), and like printf, no more
+ * than the precision is read, so "%.4s" needs no NUL within 4 bytes.
+ * Returns number of bytes used in "buf", or -1 if the format can't be
+ * deferred (e.g. "%n", positional args, wide chars) or the args don't fit.
+ * On -1, "args" is indeterminate; restart it before formatting normally. */
+
+int lgr_fmt_render(char *buf, int buf_size, const char *fmt,
+    const char *packed, int packed_len);
+/* Format "fmt" using args previously saved by lgr_fmt_pack().
+ * Same semantics as snprintf(): "buf" is always NUL-terminated (if
+ * buf_size > 0), and the return value is the length of the full message
+ * (which can be >= buf_size if truncated), or -1 if "packed" is bad. */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LGR_FMT_H */
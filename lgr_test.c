@@ -10,6 +10,10 @@
  * Project home: https://github.com/fordsfords/lgr
  */
 
+#if ! defined(_WIN32)
+#define _GNU_SOURCE  /* pthread_getname_np() */
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
@@ -18,6 +22,7 @@
   #include <time.h>
   #include <unistd.h>
   #include <sys/time.h>
+  #include <sys/mman.h>
 #endif
 
 /* Intercept CPRT_TIMEOFDAY */
@@ -62,6 +67,46 @@ int is_file_readable(char *fname)
 }  /* is_file_readable */
 
 
+/* Return number of lines in file that contain str. */
+int count_lines(char *fname, char *str)
+{
+  FILE *fp;
+  char line[1024];
+  int count = 0;
+
+  fp = fopen(fname, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (strstr(line, str) != NULL) {
+      count++;
+    }
+  }
+  fclose(fp);
+  return count;
+}  /* count_lines */
+
+
+#define NUM_THREAD_LOGS 100
+CPRT_THREAD_ENTRYPOINT log_thread(void *in_arg)
+{
+  lgr_t *lgr = (lgr_t *)in_arg;
+  lgr_err_t err;
+  int i;
+
+  for (i = 0; i < NUM_THREAD_LOGS; i++) {
+    while ((err = lgr_log(lgr, LGR_SEV_FYI, "thread log %d", i)) == LGR_ERR_QFULL) {
+      CPRT_SLEEP_MS(1);
+    }
+    CPRT_ASSERT(err == LGR_ERR_OK);
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* log_thread */
+
+
 char *ten_chars = "1234567890";
 
 int main(int argc, char **argv)
@@ -282,7 +327,7 @@ int main(int argc, char **argv)
   found = 0;
   CPRT_SLEEP_MS(1);
   for (i = 1; i < 5000; i+=50) {
-    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.000013 ERR lgr: Overflow, FYI:4, ATTN:0, WARN:0, ERR:2, FATAL:0 logs dropped over 0.000014 sec'") == 0) {
+    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.000013 ERR lgr: Overflow, TRACE:0, DEBUG:0, FYI:4, ATTN:0, WARN:0, ERR:2, FATAL:0 logs dropped over 0.000014 sec'") == 0) {
       found = 1;
       break;
     }
@@ -317,7 +362,7 @@ int main(int argc, char **argv)
   found = 0;
   CPRT_SLEEP_MS(1);
   for (i = 1; i < 5000; i+=50) {
-    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.000028 ERR lgr: Overflow, FYI:4, ATTN:0, WARN:0, ERR:2, FATAL:0 logs dropped over 0.000014 sec'") == 0) {
+    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.000028 ERR lgr: Overflow, TRACE:0, DEBUG:0, FYI:4, ATTN:0, WARN:0, ERR:2, FATAL:0 logs dropped over 0.000014 sec'") == 0) {
       found = 1;
       break;
     }
@@ -332,7 +377,7 @@ int main(int argc, char **argv)
 /*****************************************/
   fprintf(stderr, "Testing size limit..."); fflush(stdout);
 
-  for (bytes = 1439 + 65; bytes < (1024*1024); bytes += 65) {
+  for (bytes = 1475 + 65; bytes < (1024*1024); bytes += 65) {
     while (q_is_empty(lgr->pool_q)) { };  /* Spin while the log q is full. */
     CPRT_ASSERT(lgr_log(lgr, LGR_SEV_WARN, "123456789012345678901234 %07d", bytes) == LGR_ERR_OK);
   }
@@ -341,7 +386,7 @@ int main(int argc, char **argv)
   found = 0;
   CPRT_SLEEP_MS(1);
   for (i = 1; i < 5000; i+=50) {
-    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.016151 WARN 123456789012345678901234 1048524'") == 0) {
+    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.016151 WARN 123456789012345678901234 1048560'") == 0) {
       found = 1;
       break;
     }
@@ -350,7 +395,7 @@ int main(int argc, char **argv)
   fprintf(stderr, "%d ms...", i);
   CPRT_ASSERT(found);
 
-  CPRT_ASSERT(bytes == 1048524);
+  CPRT_ASSERT(bytes == 1048560);
   CPRT_ASSERT(bytes == (int)lgr->cur_file_size_bytes);
 
   /* This one succeeds but exceeds the file size. */
@@ -360,7 +405,7 @@ int main(int argc, char **argv)
   found = 0;
   CPRT_SLEEP_MS(1);
   for (i = 1; i < 5000; i+=50) {
-    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.016152 WARN Last successful 78901234 1048589'") == 0) {
+    if (system("./chk_log.sh -f x._wed -s '2022/05/18 00:00:00.016152 WARN Last successful 78901234 1048625'") == 0) {
       found = 1;
       break;
     }
@@ -409,7 +454,7 @@ int main(int argc, char **argv)
   found = 0;
   CPRT_SLEEP_MS(1);
   for (i = 1; i < 5000; i+=50) {
-    if (system("./chk_log.sh -l 2 -f x._thu -s '2022/05/19 00:00:00.016157 ERR lgr: File size drops, FYI:0, ATTN:0, WARN:1, ERR:0, FATAL:0 logs dropped'") == 0) {
+    if (system("./chk_log.sh -l 2 -f x._thu -s '2022/05/19 00:00:00.016157 ERR lgr: File size drops, TRACE:0, DEBUG:0, FYI:0, ATTN:0, WARN:1, ERR:0, FATAL:0 logs dropped'") == 0) {
       found = 1;
       break;
     }
@@ -421,7 +466,7 @@ int main(int argc, char **argv)
   found = 0;
   CPRT_SLEEP_MS(1);
   for (i = 1; i < 5000; i+=50) {
-    if (system("./chk_log.sh -f x._thu -s '2022/05/19 00:00:00.016155 WARN New day, works 678901234 1048719'") == 0) {
+    if (system("./chk_log.sh -f x._thu -s '2022/05/19 00:00:00.016155 WARN New day, works 678901234 1048755'") == 0) {
       found = 1;
       break;
     }
@@ -462,6 +507,1066 @@ int main(int argc, char **argv)
 
   fprintf(stderr, "OK.\n"); fflush(stdout);
 
+/*****************************************/
+  fprintf(stderr, "Testing PER_THREAD..."); fflush(stdout);
+  {
+    CPRT_THREAD_T tids[3];
+
+    /* Registration and unlinking of threads need log_lock. */
+    CPRT_ASSERT(lgr_create(&lgr, 32, 16, 1,
+        LGR_FLAGS_PER_THREAD | LGR_FLAGS_NOLOCK, "y.", 1) == LGR_ERR_FLAGS);
+
+    CPRT_ASSERT(lgr_create(&lgr,
+        32,    /* max_msg_size */
+        16,    /* q_size */
+        1,     /* sleep_ms */
+        LGR_FLAGS_PER_THREAD,
+        "y.",  /* file_prefix */
+        1)     /* max_file_size_mb */
+      == LGR_ERR_OK);
+
+    for (i = 0; i < 3; i++) {
+      CPRT_THREAD_CREATE(tids[i], log_thread, lgr);
+    }
+    for (i = 0; i < 3; i++) {
+      CPRT_THREAD_JOIN(tids[i]);
+    }
+    /* Give the logger thread time to free the exited threads' queues. */
+    CPRT_SLEEP_MS(50);
+    CPRT_ASSERT(lgr->threads == NULL);
+
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "main thread log") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr->threads != NULL);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", "FYI thread log ") == 3 * NUM_THREAD_LOGS);
+    CPRT_ASSERT(count_lines("y._thu", "FYI thread log 99") == 3);
+    CPRT_ASSERT(count_lines("y._thu", "FYI main thread log") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "FYI lgr: Exiting.") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing BYTE_RING..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_err_t err;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 32;
+    attr.q_size = 64;
+    attr.flags = LGR_FLAGS_BYTE_RING | LGR_FLAGS_PER_THREAD;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_FLAGS);
+
+    attr.flags = LGR_FLAGS_BYTE_RING;
+    attr.ring_size = 1000;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_RINGSIZE);
+    attr.ring_size = 128;  /* Less than two max-sized logs. */
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_RINGSIZE);
+
+    /* Room for only a few logs, so it wraps many times. */
+    attr.ring_size = 512;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    for (i = 0; i < 100; i++) {
+      while ((err = lgr_log(lgr, LGR_SEV_FYI, "ring log %d", i)) == LGR_ERR_QFULL) {
+        CPRT_SLEEP_MS(1);
+      }
+      CPRT_ASSERT(err == LGR_ERR_OK);
+    }
+    while (lgr_log(lgr, LGR_SEV_ERR, "123456789012345678901234567890123") == LGR_ERR_QFULL) {
+      CPRT_SLEEP_MS(1);
+    }
+    while (lgr_log(lgr, LGR_SEV_ERR, "12345678901234567890123456789012") == LGR_ERR_QFULL) {
+      CPRT_SLEEP_MS(1);
+    }
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", "FYI ring log ") == 100);
+    CPRT_ASSERT(count_lines("y._thu", "FYI ring log 99\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "ERR 12345678901234567890123456789012...(message truncated)\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "ERR 12345678901234567890123456789012\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing DEFER_FMT..."); fflush(stdout);
+  {
+    char str_arg[16];
+    char expect[200];
+    int n;
+
+    CPRT_ASSERT(lgr_create(&lgr,
+        64,    /* max_msg_size */
+        16,    /* q_size */
+        1,     /* sleep_ms */
+        LGR_FLAGS_DEFER_FMT | LGR_FLAGS_BYTE_RING,
+        "y.",  /* file_prefix */
+        1)     /* max_file_size_mb */
+      == LGR_ERR_OK);
+
+    /* Strings must be copied, not referenced. */
+    strcpy(str_arg, "abc");
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "%d|%5.2f|%-5s|%x|%c|%lu|%lld|%%|%*d|%.*s|%hhd|%zu|%Lg",
+        -42, 3.14159, str_arg, 255, 'z', 123456789012ul, -5ll, 4, 7, 2, "xyz",
+        (char)300, (size_t)99, (long double)1.5) == LGR_ERR_OK);
+    strcpy(str_arg, "XXX");
+    n = snprintf(expect, sizeof(expect), "%d|%5.2f|%-5s|%x|%c|%lu|%lld|%%|%*d|%.*s|%hhd|%zu|%Lg",
+        -42, 3.14159, "abc", 255, 'z', 123456789012ul, -5ll, 4, 7, 2, "xyz",
+        (char)300, (size_t)99, (long double)1.5);
+    CPRT_ASSERT(n <= 64);
+
+    /* Not deferrable, formatted by caller. */
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "n=%n", &n) == LGR_ERR_OK);
+
+    /* Truncation. */
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_ERR, "%s%s", "12345678901234567890123456789012",
+        "345678901234567890123456789012345") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_ERR, "%s%s", "12345678901234567890123456789012",
+        "34567890123456789012345678901234") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    strcat(expect, "\n");
+    CPRT_ASSERT(count_lines("y._thu", expect) == 1);
+    CPRT_ASSERT(count_lines("y._thu", " FYI n=\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " ERR 1234567890123456789012345678901234567890123456789012345678901234...(message truncated)\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " ERR 1234567890123456789012345678901234567890123456789012345678901234\n") == 1);
+
+    /* Precision bounds the string read: a char[4] with no NUL, right
+     * before an inaccessible page, so reading past it would crash. */
+    {
+      long page = sysconf(_SC_PAGESIZE);
+      char *pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      char *four;
+
+      CPRT_ASSERT(pages != MAP_FAILED);
+      CPRT_ASSERT(mprotect(pages + page, page, PROT_NONE) == 0);
+      four = pages + page - 4;
+      memcpy(four, "wxyz", 4);
+
+      CPRT_ASSERT(lgr_create(&lgr, 64, 16, 1, LGR_FLAGS_DEFER_FMT, "y.", 1)
+          == LGR_ERR_OK);
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "prec=%.4s", four) == LGR_ERR_OK);
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "star=%.*s", 4, four)
+          == LGR_ERR_OK);
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "short=%.2s", four)
+          == LGR_ERR_OK);
+      CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+      munmap(pages, 2 * page);
+
+      CPRT_ASSERT(count_lines("y._thu", " FYI prec=wxyz\n") == 1);
+      CPRT_ASSERT(count_lines("y._thu", " FYI star=wxyz\n") == 1);
+      CPRT_ASSERT(count_lines("y._thu", " FYI short=wx\n") == 1);
+    }
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing BINARY..."); fflush(stdout);
+  {
+    FILE *fp;
+    char magic[8];
+
+    CPRT_ASSERT(lgr_create(&lgr,
+        32,    /* max_msg_size */
+        16,    /* q_size */
+        1,     /* sleep_ms */
+        LGR_FLAGS_BINARY | LGR_FLAGS_DEFER_FMT,
+        "y.",  /* file_prefix */
+        1)     /* max_file_size_mb */
+      == LGR_ERR_OK);
+
+    for (i = 0; i < 3; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_WARN, "bin log %d %s", i, "abc") == LGR_ERR_OK);
+    }
+    /* Not deferrable, written as text. */
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "bin n=%n", &i) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_ERR, "bin %s", "12345678901234567890123456789") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_ERR, "bin %s", "1234567890123456789012345678") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    fp = fopen("y._thu", "rb");
+    CPRT_ASSERT(fp != NULL);
+    CPRT_ASSERT(fread(magic, sizeof(magic), 1, fp) == 1);
+    fclose(fp);
+    CPRT_ASSERT(memcmp(magic, LGR_BIN_MAGIC, sizeof(magic)) == 0);
+
+    CPRT_ASSERT(system("./lgr_decode y._thu >y._txt") == 0);
+    CPRT_ASSERT(count_lines("y._txt", " FYI lgr: Opening file.\n") == 1);
+    CPRT_ASSERT(count_lines("y._txt", " FYI lgr: Starting.\n") == 1);
+    CPRT_ASSERT(count_lines("y._txt", " WARN bin log ") == 3);
+    CPRT_ASSERT(count_lines("y._txt", " WARN bin log 2 abc\n") == 1);
+    CPRT_ASSERT(count_lines("y._txt", " FYI bin n=\n") == 1);
+    CPRT_ASSERT(count_lines("y._txt", " ERR bin 1234567890123456789012345678...(message truncated)\n") == 1);
+    CPRT_ASSERT(count_lines("y._txt", " ERR bin 1234567890123456789012345678\n") == 1);
+    CPRT_ASSERT(count_lines("y._txt", " FYI lgr: Exiting.\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing TSC_TS..."); fflush(stdout);
+  {
+    CPRT_ASSERT(lgr_create(&lgr, 32, 16, 1,
+        LGR_FLAGS_TSC_TS | LGR_FLAGS_DEFER_TS, "y.", 1) == LGR_ERR_FLAGS);
+
+    CPRT_ASSERT(lgr_create(&lgr,
+        32,    /* max_msg_size */
+        16,    /* q_size */
+        1,     /* sleep_ms */
+        LGR_FLAGS_TSC_TS,
+        "y.",  /* file_prefix */
+        1)     /* max_file_size_mb */
+      == LGR_ERR_OK);
+    /* Falls back to gettimeofday without an invariant TSC. */
+    CPRT_ASSERT(((lgr->flags & LGR_FLAGS_TSC_TS) != 0) == cprt_tsc_invariant());
+
+    for (i = 0; i < 3; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "tsc log %d", i) == LGR_ERR_OK);
+    }
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", " FYI tsc log ") == 3);
+    CPRT_ASSERT(count_lines("y._thu", "2022/05/19 00:00:00.") == 6);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing out_buf_size..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    char big[201];
+    char expect[300];
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 200;
+    attr.q_size = 16;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.out_buf_size = 0;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OUTBUFSIZE);
+
+    /* Smaller than some lines, so those bypass the buffer. */
+    attr.out_buf_size = 100;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    memset(big, 'b', 200);
+    big[200] = '\0';
+    for (i = 0; i < 3; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "small %d", i) == LGR_ERR_OK);
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "big %d %s", i, big) == LGR_ERR_OK);
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "medium %d %.60s", i, big) == LGR_ERR_OK);
+    }
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", " FYI small ") == 3);
+    snprintf(expect, sizeof(expect), " FYI big 2 %.194s...(message truncated)\n", big);
+    CPRT_ASSERT(count_lines("y._thu", expect) == 1);
+    CPRT_ASSERT(count_lines("y._thu", " FYI medium ") == 3);
+    CPRT_ASSERT(count_lines("y._thu", " FYI lgr: Exiting.\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing IO_URING..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_err_t err;
+    char big[201];
+    char expect[300];
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 200;
+    attr.q_size = 64;
+    attr.flags = LGR_FLAGS_IO_URING;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.out_buf_size = 256;  /* Lots of writes, some bypassing buffers. */
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    /* (Falls back to synchronous writes if io_uring is not available.) */
+    fprintf(stderr, "%s...", (lgr->flags & LGR_FLAGS_IO_URING) ? "async" : "sync");
+
+    memset(big, 'u', 200);
+    big[200] = '\0';
+    for (i = 0; i < 300; i++) {
+      while ((err = lgr_log(lgr, LGR_SEV_FYI, "uring %d", i)) == LGR_ERR_QFULL) {
+        CPRT_SLEEP_MS(1);
+      }
+      CPRT_ASSERT(err == LGR_ERR_OK);
+      if (i % 100 == 0) {
+        CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "big %d %.190s", i, big) == LGR_ERR_OK);
+      }
+    }
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", " FYI uring ") == 300);
+    CPRT_ASSERT(count_lines("y._thu", " FYI uring 299\n") == 1);
+    snprintf(expect, sizeof(expect), " FYI big 200 %.190s\n", big);
+    CPRT_ASSERT(count_lines("y._thu", expect) == 1);
+    CPRT_ASSERT(count_lines("y._thu", " FYI lgr: Exiting.\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing MMAP..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_err_t err;
+    char *big;
+    FILE *fp;
+    int c, nuls, prev_c;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 65536;
+    attr.q_size = 16;
+    attr.flags = LGR_FLAGS_MMAP | LGR_FLAGS_IO_URING;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 8;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_FLAGS);
+
+    attr.flags = LGR_FLAGS_MMAP;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    big = (char *)malloc(60001);
+    memset(big, 'm', 60000);
+    big[60000] = '\0';
+    /* Enough to cross into the second mapping window. */
+    for (i = 0; i < 80; i++) {
+      while ((err = lgr_log(lgr, LGR_SEV_FYI, "mmap %d %s", i, big)) == LGR_ERR_QFULL) {
+        CPRT_SLEEP_MS(1);
+      }
+      CPRT_ASSERT(err == LGR_ERR_OK);
+    }
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "mmap done") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    free(big);
+
+    CPRT_ASSERT(count_lines("y._thu", " FYI mmap ") == 81);
+    CPRT_ASSERT(count_lines("y._thu", " FYI mmap 79 mmm") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " FYI mmap done\n") == 1);
+
+    /* Preallocated space was trimmed. */
+    fp = fopen("y._thu", "r");
+    CPRT_ASSERT(fp != NULL);
+    nuls = 0;
+    prev_c = EOF;
+    while ((c = getc(fp)) != EOF) {
+      if (c == '\0') {
+        nuls++;
+      }
+      prev_c = c;
+    }
+    CPRT_ASSERT(ftell(fp) > 4 * 1024 * 1024);
+    fclose(fp);
+    CPRT_ASSERT(nuls == 0);
+    CPRT_ASSERT(prev_c == '\n');
+    CPRT_ASSERT(count_lines("y._thu", " FYI lgr: Exiting.\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing WAKEUP..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 32;
+    attr.q_size = 16;
+    attr.sleep_ms = 10000;  /* Not used with LGR_FLAGS_WAKEUP. */
+    attr.flags = LGR_FLAGS_WAKEUP;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.spin_us = 10;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    /* Logger thread should park soon after spinning. */
+    for (i = 0; i < 500 && ! lgr->sleeping; i++) {
+      CPRT_SLEEP_MS(1);
+    }
+    CPRT_ASSERT(lgr->sleeping);
+
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "wakeup") == LGR_ERR_OK);
+    /* Must show up well before the park timeout. */
+    for (i = 0; i < LGR_PARK_MS / 2; i++) {
+      if (count_lines("y._thu", " FYI wakeup\n") == 1) {
+        break;
+      }
+      CPRT_SLEEP_MS(1);
+    }
+    fprintf(stderr, "%d ms...", i);
+    CPRT_ASSERT(i < LGR_PARK_MS / 2);
+
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " FYI lgr: Exiting.\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing block_us..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 32;
+    attr.q_size = 4;
+    attr.sleep_ms = 500;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.block_us = 2000000;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    /* Waits for the logger instead of overflowing. */
+    for (i = 0; i < 20; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "block %d", i) == LGR_ERR_OK);
+    }
+    CPRT_ASSERT(lgr->blocked_logs > 0);
+    CPRT_ASSERT(lgr->blocked_ns > 0);
+    CPRT_ASSERT(lgr->blocked_timeouts == 0);
+
+    /* Fill the pool, then give up after a short wait. */
+    while (lgr_log_block(lgr, 0, LGR_SEV_FYI, "fill") == LGR_ERR_OK) {
+    }
+    CPRT_ASSERT(lgr_log_block(lgr, 1000, LGR_SEV_FYI, "timeout") == LGR_ERR_QFULL);
+    CPRT_ASSERT(lgr->blocked_timeouts == 1);
+
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " FYI block ") == 20);
+    CPRT_ASSERT(count_lines("y._thu", " FYI block 19\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " FYI timeout\n") == 0);
+    CPRT_ASSERT(count_lines("y._thu", " FYI lgr: Exiting.\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing sev_reserve..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    int pass, fyi_cnt, attn_cnt, err_cnt;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 32;
+    attr.q_size = 16;  /* 13 logs. */
+    attr.sleep_ms = 1000;  /* Logger won't drain during the test. */
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.sev_reserve[LGR_SEV_FYI] = 13;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_RESERVE);
+
+    attr.sev_reserve[LGR_SEV_FYI] = 8;
+    attr.sev_reserve[LGR_SEV_ATTN] = 4;
+    attr.sev_reserve[LGR_SEV_WARN] = 4;
+    for (pass = 0; pass < 2; pass++) {
+      attr.flags = (pass == 0) ? 0 : LGR_FLAGS_BYTE_RING;
+      CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+      for (fyi_cnt = 0; lgr_log(lgr, LGR_SEV_FYI, "fyi") == LGR_ERR_OK; fyi_cnt++) {
+      }
+      for (attn_cnt = 0; lgr_log(lgr, LGR_SEV_ATTN, "attn") == LGR_ERR_OK; attn_cnt++) {
+      }
+      for (err_cnt = 0; lgr_log(lgr, LGR_SEV_ERR, "err") == LGR_ERR_OK; err_cnt++) {
+      }
+      CPRT_ASSERT(fyi_cnt == 5);
+      CPRT_ASSERT(attn_cnt == 4);
+      CPRT_ASSERT(err_cnt == 4);
+
+      CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+      CPRT_ASSERT(count_lines("y._thu", " FYI fyi\n") == 5);
+      CPRT_ASSERT(count_lines("y._thu", " ATTN attn\n") == 4);
+      CPRT_ASSERT(count_lines("y._thu", " ERR err\n") == 4);
+      CPRT_ASSERT(count_lines("y._thu", " ERR lgr: Overflow, TRACE:0, DEBUG:0, FYI:1, ATTN:1, WARN:0, ERR:1, FATAL:0 ") == 1);
+    }
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing LGR_LOG_RATELIMITED..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    char expect[256];
+    int pass, rl_line, smp_line;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 32;
+    attr.q_size = 256;
+    attr.sleep_ms = 10;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    /* Second pass re-registers the sites with a new lgr. */
+    for (pass = 0; pass < 2; pass++) {
+      CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+      for (i = 0; i < 100; i++) {
+        rl_line = __LINE__; LGR_LOG_RATELIMITED(lgr, LGR_SEV_WARN, 10, "rl %d", i);
+        smp_line = __LINE__; LGR_LOG_SAMPLED(lgr, LGR_SEV_FYI, 4, "smp %d", i);
+      }
+
+      CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+      CPRT_ASSERT(count_lines("y._thu", " WARN rl ") == 10);
+      CPRT_ASSERT(count_lines("y._thu", " WARN rl 9\n") == 1);
+      CPRT_ASSERT(count_lines("y._thu", " FYI smp ") == 25);
+      CPRT_ASSERT(count_lines("y._thu", " FYI smp 96\n") == 1);
+      snprintf(expect, sizeof(expect), " WARN lgr: Suppressed 90 logs from %s:%d\n",
+          __FILE__, rl_line);
+      CPRT_ASSERT(count_lines("y._thu", expect) == 1);
+      snprintf(expect, sizeof(expect), " FYI lgr: Suppressed 75 logs from %s:%d\n",
+          __FILE__, smp_line);
+      CPRT_ASSERT(count_lines("y._thu", expect) == 1);
+      CPRT_ASSERT(count_lines("y._thu", " FYI lgr: Exiting.\n") == 1);
+    }
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing min_sev..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    int evals;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 32;
+    attr.q_size = 64;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.min_sev = LGR_LAST_SEV + 1;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_SEVERITY);
+    attr.min_sev = LGR_SEV_DEBUG;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    evals = 0;
+    CPRT_ASSERT(LGR_LOG(lgr, LGR_SEV_TRACE, "trace %d", ++evals) == LGR_ERR_OK);
+    CPRT_ASSERT(evals == 0);  /* Arguments not evaluated. */
+    CPRT_ASSERT(LGR_LOG(lgr, LGR_SEV_DEBUG, "debug %d", ++evals) == LGR_ERR_OK);
+    CPRT_ASSERT(evals == 1);
+
+    CPRT_ASSERT(lgr_set_min_sev(lgr, LGR_LAST_SEV + 1) == LGR_ERR_SEVERITY);
+    CPRT_ASSERT(lgr_set_min_sev(lgr, LGR_SEV_WARN) == LGR_ERR_OK);
+    CPRT_ASSERT(LGR_LOG(lgr, LGR_SEV_ATTN, "attn %d", ++evals) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "fyi") == LGR_ERR_OK);
+    CPRT_ASSERT(evals == 1);
+    CPRT_ASSERT(LGR_LOG(lgr, LGR_SEV_WARN, "warn %d", ++evals) == LGR_ERR_OK);
+    CPRT_ASSERT(evals == 2);
+
+    CPRT_ASSERT(lgr_set_min_sev(lgr, LGR_SEV_TRACE) == LGR_ERR_OK);
+    CPRT_ASSERT(LGR_LOG(lgr, LGR_SEV_TRACE, "trace %d", ++evals) == LGR_ERR_OK);
+
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " DEBUG debug 1\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " WARN warn 2\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " TRACE trace 3\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " attn ") == 0);
+    CPRT_ASSERT(count_lines("y._thu", " fyi") == 0);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing q batch..."); fflush(stdout);
+  {
+    q_t *q;
+    void *msgs[10];
+    void *out[10];
+
+    CPRT_ASSERT(q_create(&q, 8) == QERR_OK);  /* Holds 7. */
+    for (i = 0; i < 10; i++) {
+      msgs[i] = (void *)(uintptr_t)(i + 1);
+    }
+    CPRT_ASSERT(q_enq_batch(q, msgs, 5) == 5);
+    CPRT_ASSERT(q_enq_batch(q, &msgs[5], 5) == 2);  /* Partial. */
+    CPRT_ASSERT(q_enq_batch(q, msgs, 1) == 0);
+    CPRT_ASSERT(q_count(q) == 7);
+
+    CPRT_ASSERT(q_deq_batch(q, out, 3) == 3);
+    CPRT_ASSERT(out[0] == msgs[0] && out[2] == msgs[2]);
+    CPRT_ASSERT(q_enq_batch(q, &msgs[7], 3) == 3);  /* Wraps. */
+    CPRT_ASSERT(q_deq_batch(q, out, 10) == 7);
+    CPRT_ASSERT(out[0] == msgs[3] && out[3] == msgs[6] && out[6] == msgs[9]);
+    CPRT_ASSERT(q_deq_batch(q, out, 10) == 0);
+    CPRT_ASSERT(q_is_empty(q));
+    CPRT_ASSERT(q_delete(q) == QERR_OK);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing MPMC..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    CPRT_THREAD_T tids[4];
+    qm_t *qm;
+    void *m;
+
+    CPRT_ASSERT(qm_create(&qm, 4) == QERR_OK);  /* Holds all 4. */
+    for (i = 0; i < 4; i++) {
+      CPRT_ASSERT(qm_enq(qm, (void *)(uintptr_t)(i + 1)) == QERR_OK);
+    }
+    CPRT_ASSERT(qm_enq(qm, (void *)99) == QERR_FULL);
+    CPRT_ASSERT(qm_count(qm) == 4);
+    for (i = 0; i < 6; i++) {  /* Wrap around. */
+      CPRT_ASSERT(qm_deq(qm, &m) == QERR_OK);
+      CPRT_ASSERT(m == (void *)(uintptr_t)(i + 1));
+      CPRT_ASSERT(qm_enq(qm, (void *)(uintptr_t)(i + 5)) == QERR_OK);
+    }
+    for (i = 0; i < 4; i++) {
+      CPRT_ASSERT(qm_deq(qm, &m) == QERR_OK);
+    }
+    CPRT_ASSERT(m == (void *)10);
+    CPRT_ASSERT(qm_deq(qm, &m) == QERR_EMPTY);
+    CPRT_ASSERT(qm_is_empty(qm));
+    CPRT_ASSERT(qm_delete(qm) == QERR_OK);
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 32;
+    attr.q_size = 16;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.flags = LGR_FLAGS_MPMC | LGR_FLAGS_PER_THREAD;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_FLAGS);
+    attr.flags = LGR_FLAGS_MPMC;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    for (i = 0; i < 4; i++) {
+      CPRT_THREAD_CREATE(tids[i], log_thread, lgr);
+    }
+    for (i = 0; i < 4; i++) {
+      CPRT_THREAD_JOIN(tids[i]);
+    }
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", "FYI thread log ") == 4 * NUM_THREAD_LOGS);
+    CPRT_ASSERT(count_lines("y._thu", "FYI thread log 99\n") == 4);
+    CPRT_ASSERT(count_lines("y._thu", "FYI lgr: Exiting.") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing arena..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_err_t err;
+    lgr_log_t *log;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 100;
+    attr.q_size = 1024;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.flags = LGR_FLAGS_HUGEPAGES | LGR_FLAGS_PREFAULT | LGR_FLAGS_MLOCK;
+    err = lgr_create_attr(&lgr, &attr);
+    if (err == LGR_ERR_MLOCK) {  /* E.g. RLIMIT_MEMLOCK too small. */
+      fprintf(stderr, "no mlock...");
+      attr.flags &= ~LGR_FLAGS_MLOCK;
+      err = lgr_create_attr(&lgr, &attr);
+    }
+    CPRT_ASSERT(err == LGR_ERR_OK);
+    fprintf(stderr, "%s...", lgr->arena_mapped ? "hugetlb" : "thp");
+
+    /* One aligned arena holds every pool log. */
+    CPRT_ASSERT(((uintptr_t)lgr->arena % LGR_HUGEPAGE_SIZE) == 0);
+    CPRT_ASSERT(lgr->arena_size == LGR_HUGEPAGE_SIZE);
+    CPRT_ASSERT(q_count(lgr->pool_q) == 1021);
+    CPRT_ASSERT(q_deq(lgr->pool_q, (void **)&log) == QERR_OK);
+    CPRT_ASSERT((char *)log >= lgr->arena
+        && (char *)log < lgr->arena + lgr->arena_size);
+    CPRT_ASSERT(((uintptr_t)log % LGR_LOG_ALIGN) == 0);
+    CPRT_ASSERT(q_enq(lgr->pool_q, log) == QERR_OK);
+
+    for (i = 0; i < 100; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "arena %d", i) == LGR_ERR_OK);
+    }
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " FYI arena ") == 100);
+    CPRT_ASSERT(count_lines("y._thu", " FYI arena 99\n") == 1);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing thread placement..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_err_t err;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 100;
+    attr.q_size = 64;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.cpu_mask = 1;  /* CPU 0 always exists. */
+    attr.sched_policy = SCHED_OTHER;
+    attr.sched_priority = 0;
+    attr.thread_name = "lgr_test_thread_long";
+    attr.numa_node = 0;
+    err = lgr_create_attr(&lgr, &attr);
+    if (err == LGR_ERR_NUMA) {  /* Kernel without NUMA policy support. */
+      fprintf(stderr, "no numa...");
+      attr.numa_node = -1;
+      err = lgr_create_attr(&lgr, &attr);
+    }
+    CPRT_ASSERT(err == LGR_ERR_OK);
+#if defined(__linux__)
+    {
+      char name[32];
+      CPRT_ASSERT(pthread_getname_np(lgr->thread_id, name, sizeof(name)) == 0);
+      CPRT_ASSERT(strcmp(name, "lgr_test_thread") == 0);  /* Truncated. */
+    }
+#endif
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "placed") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " FYI placed\n") == 1);
+
+    /* Failures are reported by lgr_create_attr(). */
+    lgr_attr_init(&attr);
+    attr.file_prefix = "y.";
+    attr.sched_policy = SCHED_OTHER;
+    attr.sched_priority = 5;  /* SCHED_OTHER only allows 0. */
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_THREAD);
+    attr.sched_policy = -1;
+    attr.cpu_mask = (uint64_t)1 << 63;  /* No such CPU. */
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_THREAD);
+    attr.cpu_mask = 0;
+    attr.numa_node = 1000;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_NUMA);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing stats..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_stats_t stats;
+    lgr_hist_t hist;
+    uint64_t ovf, sum;
+    int b, tries;
+
+    memset(&hist, 0, sizeof(hist));
+    hist.buckets[3] = 50;  /* 8-15 ns. */
+    hist.buckets[10] = 50;  /* 1024-2047 ns. */
+    hist.cnt = 100;
+    hist.max_ns = 1500;
+    CPRT_ASSERT(lgr_hist_pct(&hist, 50) == 15);
+    CPRT_ASSERT(lgr_hist_pct(&hist, 99) == 1500);  /* Capped at max. */
+    hist.cnt = 0;
+    CPRT_ASSERT(lgr_hist_pct(&hist, 50) == 0);
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 100;
+    attr.q_size = 16;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.flags = LGR_FLAGS_STATS;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+    for (i = 0; i < 100; i++) {
+      lgr_log(lgr, LGR_SEV_FYI, "stats %d", i);
+    }
+    /* Wait for the logger thread to catch up and flush. */
+    for (tries = 0; tries < 5000; tries++) {
+      CPRT_ASSERT(lgr_get_stats(lgr, &stats) == LGR_ERR_OK);
+      ovf = 0;
+      for (i = 0; i <= LGR_LAST_SEV; i++) {
+        ovf += stats.overflows[i];
+      }
+      if (stats.logs + ovf == 100 && stats.write_ns.cnt > 0) {
+        break;
+      }
+      CPRT_SLEEP_MS(1);
+    }
+    CPRT_ASSERT(stats.logs + ovf == 100);
+    CPRT_ASSERT(ovf == stats.overflows[LGR_SEV_FYI]);
+    CPRT_ASSERT(stats.call_ns.cnt == stats.logs);
+    CPRT_ASSERT(stats.queue_ns.cnt == stats.logs);
+    CPRT_ASSERT(stats.write_ns.cnt > 0);
+    CPRT_ASSERT(stats.log_q_hwm >= 1 && stats.log_q_hwm < 16);
+    sum = 0;
+    for (b = 0; b < LGR_HIST_BUCKETS; b++) {
+      sum += stats.queue_ns.buckets[b];
+    }
+    CPRT_ASSERT(sum == stats.queue_ns.cnt);
+    CPRT_ASSERT(stats.call_ns.max_ns > 0);
+    CPRT_ASSERT(lgr_hist_pct(&stats.call_ns, 50)
+        <= lgr_hist_pct(&stats.call_ns, 99));
+    CPRT_ASSERT(lgr_hist_pct(&stats.call_ns, 99) <= stats.call_ns.max_ns);
+    CPRT_ASSERT(stats.suppressed == 0 && stats.blocked_logs == 0);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " FYI stats ") == 100 - ovf);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing size classes..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    char long_msg[3001];
+    char huge_msg[5001];
+    size_t one_class_size;
+    int c, free_logs;
+
+    memset(long_msg, 'L', 3000);
+    long_msg[3000] = '\0';
+    memset(huge_msg, 'H', 5000);
+    huge_msg[5000] = '\0';
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 4096;
+    attr.q_size = 1024;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+
+    /* Bad class configurations. */
+    attr.class_msg_size[0] = 128;  attr.class_logs[0] = 800;
+    attr.class_msg_size[1] = 1024; attr.class_logs[1] = 150;
+    attr.class_msg_size[2] = 2048; attr.class_logs[2] = 20;  /* != max */
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_CLASSES);
+    attr.class_msg_size[2] = 4096; attr.class_logs[2] = 100;  /* > 1021 */
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_CLASSES);
+    attr.class_logs[2] = 20;
+    attr.flags = LGR_FLAGS_BYTE_RING;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_FLAGS);
+    attr.flags = 0;
+
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr->num_classes == 3 && lgr->pool_q == NULL);
+    /* Much smaller than 1021 max-sized logs. */
+    one_class_size = 1021 * ((sizeof(lgr_log_t) + 4096 + 2 + LGR_LOG_ALIGN - 1)
+        & ~((size_t)LGR_LOG_ALIGN - 1));
+    CPRT_ASSERT(lgr->arena_size * 5 < one_class_size);
+
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "class %d", 0) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "class1 %.500d", 1) == LGR_ERR_OK);
+    /* A class 0 log was taken for that, and is now the spare. */
+    CPRT_ASSERT(lgr->class_spare[0] != NULL);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "class %d", 2) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr->class_spare[0] == NULL);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "class2 %s", long_msg) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "%s", huge_msg) == LGR_ERR_OK);
+    CPRT_SLEEP_MS(100);
+
+    /* Every log is back in its pool, or a spare. */
+    free_logs = 0;
+    for (c = 0; c < 3; c++) {
+      free_logs += q_count(lgr->class_pool_q[c]);
+      free_logs += (lgr->class_spare[c] != NULL);
+    }
+    CPRT_ASSERT(free_logs == 800 + 150 + 20);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", " FYI class 0\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " FYI class 2\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "1\n") >= 1);
+    CPRT_ASSERT(count_lines("y._thu", "LLLLLLLLLL\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "HHHHHHHHHH" LGR_TRUNC_SUFFIX "\n") == 1);
+
+    /* Deferred formatting packs into the class too. */
+    attr.flags = LGR_FLAGS_DEFER_FMT;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "deferred %d", 3) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "deferred %s", long_msg)
+        == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " FYI deferred 3\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "LLLLLLLLLL\n") == 1);
+
+    /* A full log of a smaller class is not mistaken for a truncated one,
+     * even with junk just past its message. */
+    {
+      lgr_attr_t attr2;
+      lgr_log_t *log;
+      char full_msg[4096];
+
+      memset(full_msg, 'F', 4095);
+      full_msg[4095] = '\0';
+      lgr_attr_init(&attr2);
+      attr2.max_msg_size = 4096;
+      attr2.q_size = 16;
+      attr2.file_prefix = "y.";
+      attr2.max_file_size_mb = 1;
+      attr2.class_msg_size[0] = 4095; attr2.class_logs[0] = 1;
+      attr2.class_msg_size[1] = 4096; attr2.class_logs[1] = 1;
+      CPRT_ASSERT(lgr_create_attr(&lgr, &attr2) == LGR_ERR_OK);
+      CPRT_ASSERT(q_deq(lgr->class_pool_q[0], (void **)&log) == QERR_OK);
+      log->msg[4096] = 'X';
+      CPRT_ASSERT(q_enq(lgr->class_pool_q[0], log) == QERR_OK);
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "%s", full_msg) == LGR_ERR_OK);
+      CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+      CPRT_ASSERT(count_lines("y._thu", "FFFFFFFFFF\n") == 1);
+    }
+
+    /* A spare counts against sev_reserve like any other free log. */
+    {
+      lgr_log_t *held[5];
+      int num_held = 0;
+
+      lgr_attr_init(&attr);
+      attr.max_msg_size = 4096;
+      attr.q_size = 1024;
+      attr.file_prefix = "y.";
+      attr.max_file_size_mb = 1;
+      attr.class_msg_size[0] = 128;  attr.class_logs[0] = 2;
+      attr.class_msg_size[1] = 4096; attr.class_logs[1] = 4;
+      attr.sev_reserve[LGR_SEV_FYI] = 1;
+      CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+
+      /* Leaves a class 0 spare. */
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_ERR, "%s", long_msg) == LGR_ERR_OK);
+      CPRT_ASSERT(lgr->class_spare[0] != NULL);
+      CPRT_SLEEP_MS(100);
+      /* Hold the rest of class 0 and all of class 1; only the spare is free. */
+      while (q_deq(lgr->class_pool_q[0], (void **)&held[num_held]) == QERR_OK) {
+        num_held++;
+      }
+      while (q_deq(lgr->class_pool_q[1], (void **)&held[num_held]) == QERR_OK) {
+        num_held++;
+      }
+      CPRT_ASSERT(num_held == 5);
+
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "reserved") == LGR_ERR_QFULL);
+      CPRT_ASSERT(lgr->class_spare[0] != NULL);
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_ERR, "unreserved") == LGR_ERR_OK);
+      CPRT_ASSERT(lgr->class_spare[0] == NULL);
+      CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+      CPRT_ASSERT(count_lines("y._thu", " FYI reserved\n") == 0);
+      CPRT_ASSERT(count_lines("y._thu", " ERR unreserved\n") == 1);
+    }
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing growable pool..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_stats_t stats;
+    int tries;
+
+    lgr_attr_init(&attr);
+    attr.max_msg_size = 100;
+    attr.q_size = 1024;
+    attr.sleep_ms = 10;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.pool_chunk_logs = 100;
+    attr.pool_shrink_ms = 50;
+
+    /* Bad combinations. */
+    attr.flags = LGR_FLAGS_PER_THREAD;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_FLAGS);
+    attr.flags = LGR_FLAGS_NOLOCK;  /* Shrinking needs log_lock. */
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_FLAGS);
+    /* The hooked time of day is slow, so let the logger thread be the one
+     * that calls it; then bursts back up. */
+    attr.flags = LGR_FLAGS_DEFER_TS;
+
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr->arena == NULL && lgr->num_chunks == 1);
+    CPRT_ASSERT(lgr->pool_logs == 100 && q_count(lgr->pool_q) == 100);
+
+    /* A burst that uses the whole first chunk makes the logger add one. */
+    for (tries = 0; tries < 10 && lgr->pool_grows == 0; tries++) {
+      for (i = 0; i < 100; i++) {
+        (void)lgr_log(lgr, LGR_SEV_FYI, "burst1 %d", i);
+      }
+      CPRT_SLEEP_MS(30);
+    }
+    CPRT_ASSERT(lgr->pool_grows >= 1 && lgr->num_chunks >= 2);
+
+    /* Sustained overload grows it to the cap, q_size - 3. */
+    for (tries = 0; tries < 100 && lgr->pool_logs < 1021; tries++) {
+      for (i = 0; i < 1100; i++) {
+        (void)lgr_log(lgr, LGR_SEV_FYI, "burst2 %d", i);
+      }
+      CPRT_SLEEP_MS(20);
+    }
+    CPRT_ASSERT(lgr->pool_logs == 1021 && lgr->num_chunks == 11);
+    CPRT_ASSERT(lgr_get_stats(lgr, &stats) == LGR_ERR_OK);
+    CPRT_ASSERT(stats.pool_logs == 1021 && stats.pool_grows == 10);
+
+    /* Idle: released a chunk per window, back down to the first one. */
+    for (tries = 0; tries < 1000 && lgr->num_chunks > 1; tries++) {
+      CPRT_SLEEP_MS(10);
+    }
+    CPRT_ASSERT(lgr->num_chunks == 1 && lgr->pool_logs == 100);
+    CPRT_ASSERT(q_count(lgr->pool_q) == 100);
+    CPRT_ASSERT(lgr_get_stats(lgr, &stats) == LGR_ERR_OK);
+    CPRT_ASSERT(stats.pool_shrinks == 10);
+
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "after %d", 1) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+    CPRT_ASSERT(count_lines("y._thu", " FYI after 1\n") == 1);
+
+    /* Without pool_shrink_ms, NOLOCK is fine and the pool only grows. */
+    attr.flags = LGR_FLAGS_NOLOCK | LGR_FLAGS_DEFER_TS;
+    attr.pool_shrink_ms = 0;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr->pool_scratch == NULL);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
+/*****************************************/
+  fprintf(stderr, "Testing coalesce..."); fflush(stdout);
+  {
+    lgr_attr_t attr;
+    lgr_stats_t stats;
+
+    lgr_attr_init(&attr);
+    attr.q_size = 2048;
+    attr.file_prefix = "y.";
+    attr.max_file_size_mb = 1;
+    attr.flags = LGR_FLAGS_COALESCE;
+    attr.coalesce_ms = 0;  /* Only summarize when the run ends. */
+
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    for (i = 0; i < 1000; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_ERR, "storm %d", 7) == LGR_ERR_OK);
+    }
+    /* Same text, different severity: not a repeat. */
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_WARN, "storm %d", 7) == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "calm") == LGR_ERR_OK);
+    CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "calm") == LGR_ERR_OK);
+    CPRT_SLEEP_MS(100);
+    CPRT_ASSERT(lgr_get_stats(lgr, &stats) == LGR_ERR_OK);
+    CPRT_ASSERT(stats.coalesced == 1000);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", " ERR storm 7\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu",
+        " ERR lgr: Last message repeated 999 times over ") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " WARN storm 7\n") == 1);
+    CPRT_ASSERT(count_lines("y._thu", " FYI calm\n") == 1);
+    /* The last run is summarized at exit. */
+    CPRT_ASSERT(count_lines("y._thu",
+        " FYI lgr: Last message repeated 1 times over ") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "repeated") == 2);
+
+    /* A run that goes quiet is summarized after coalesce_ms. */
+    attr.coalesce_ms = 50;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    for (i = 0; i < 10; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "tick") == LGR_ERR_OK);
+    }
+    CPRT_SLEEP_MS(200);
+    CPRT_ASSERT(count_lines("y._thu", "repeated 9 times") == 1);
+    for (i = 0; i < 5; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "tick") == LGR_ERR_OK);
+    }
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+
+    CPRT_ASSERT(count_lines("y._thu", " FYI tick\n") == 2);
+    CPRT_ASSERT(count_lines("y._thu", "repeated 9 times") == 1);
+    CPRT_ASSERT(count_lines("y._thu", "repeated 4 times") == 1);
+
+    /* A parked logger (LGR_FLAGS_WAKEUP) wakes up for the summary, well
+     * before LGR_PARK_MS. */
+    attr.flags = LGR_FLAGS_COALESCE | LGR_FLAGS_WAKEUP;
+    CPRT_ASSERT(lgr_create_attr(&lgr, &attr) == LGR_ERR_OK);
+    for (i = 0; i < 6; i++) {
+      CPRT_ASSERT(lgr_log(lgr, LGR_SEV_FYI, "tock") == LGR_ERR_OK);
+    }
+    CPRT_SLEEP_MS(300);
+    CPRT_ASSERT(count_lines("y._thu", "repeated 5 times") == 1);
+    CPRT_ASSERT(lgr_delete(lgr) == LGR_ERR_OK);
+  }
+  fprintf(stderr, "OK.\n"); fflush(stdout);
+
 
   fprintf(stderr, "All tests completed successfully.\n");
 
@@ -0,0 +1,217 @@
+/* lgr_uring.c - minimal io_uring file writer for lgr. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/lgr
+ */
+
+#include "cprt.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lgr_uring.h"
+
+#if defined(__linux__) && ! defined(LGR_NO_URING)
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct lgr_uring_s {
+  int ring_fd;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned int sq_entries;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr;
+  size_t sq_len;
+  void *cq_ptr;                /* Same as sq_ptr with IORING_FEAT_SINGLE_MMAP. */
+  size_t cq_len;
+  size_t sqes_len;
+};
+
+
+int lgr_uring_create(lgr_uring_t **rtn_uring, unsigned int entries)
+{
+  struct io_uring_params p;
+  lgr_uring_t *uring;
+
+  uring = (lgr_uring_t *)calloc(1, sizeof(lgr_uring_t));
+  if (uring == NULL) {
+    return -1;
+  }
+  uring->sq_ptr = MAP_FAILED;
+  uring->cq_ptr = MAP_FAILED;
+  uring->sqes = MAP_FAILED;
+
+  memset(&p, 0, sizeof(p));
+  uring->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (uring->ring_fd < 0) {
+    free(uring);
+    return -1;
+  }
+
+  uring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  uring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (uring->cq_len > uring->sq_len) {
+      uring->sq_len = uring->cq_len;
+    }
+    uring->cq_len = uring->sq_len;
+  }
+  uring->sq_ptr = mmap(NULL, uring->sq_len, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+  if (uring->sq_ptr == MAP_FAILED) {
+    lgr_uring_delete(uring);
+    return -1;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    uring->cq_ptr = uring->sq_ptr;
+  }
+  else {
+    uring->cq_ptr = mmap(NULL, uring->cq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_CQ_RING);
+    if (uring->cq_ptr == MAP_FAILED) {
+      lgr_uring_delete(uring);
+      return -1;
+    }
+  }
+  uring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  uring->sqes = (struct io_uring_sqe *)mmap(NULL, uring->sqes_len,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd,
+      IORING_OFF_SQES);
+  if (uring->sqes == MAP_FAILED) {
+    lgr_uring_delete(uring);
+    return -1;
+  }
+
+  uring->sq_head = (unsigned int *)((char *)uring->sq_ptr + p.sq_off.head);
+  uring->sq_tail = (unsigned int *)((char *)uring->sq_ptr + p.sq_off.tail);
+  uring->sq_mask = (unsigned int *)((char *)uring->sq_ptr + p.sq_off.ring_mask);
+  uring->sq_array = (unsigned int *)((char *)uring->sq_ptr + p.sq_off.array);
+  uring->sq_entries = p.sq_entries;
+  uring->cq_head = (unsigned int *)((char *)uring->cq_ptr + p.cq_off.head);
+  uring->cq_tail = (unsigned int *)((char *)uring->cq_ptr + p.cq_off.tail);
+  uring->cq_mask = (unsigned int *)((char *)uring->cq_ptr + p.cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe *)((char *)uring->cq_ptr + p.cq_off.cqes);
+
+  *rtn_uring = uring;
+  return 0;
+}  /* lgr_uring_create */
+
+
+int lgr_uring_write(lgr_uring_t *uring, int fd, const void *buf,
+    unsigned int len, uint64_t offset, uint64_t user_data)
+{
+  unsigned int tail = *uring->sq_tail;
+  unsigned int head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned int idx;
+  struct io_uring_sqe *sqe;
+
+  if (tail - head >= uring->sq_entries) {
+    errno = EBUSY;
+    return -1;
+  }
+  idx = tail & *uring->sq_mask;
+  sqe = &uring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  uring->sq_array[idx] = idx;
+  __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  while (syscall(__NR_io_uring_enter, uring->ring_fd, 1, 0, 0, NULL, 0) < 0) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}  /* lgr_uring_write */
+
+
+int lgr_uring_reap(lgr_uring_t *uring, int wait, int *rtn_res,
+    uint64_t *rtn_user_data)
+{
+  for (;;) {
+    unsigned int head = *uring->cq_head;
+    unsigned int tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head != tail) {
+      struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+      *rtn_res = cqe->res;
+      *rtn_user_data = cqe->user_data;
+      __atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+      return 1;
+    }
+    if (! wait) {
+      return 0;
+    }
+    if (syscall(__NR_io_uring_enter, uring->ring_fd, 0, 1,
+        IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      return -1;
+    }
+  }
+}  /* lgr_uring_reap */
+
+
+void lgr_uring_delete(lgr_uring_t *uring)
+{
+  if (uring->sqes != MAP_FAILED) {
+    munmap(uring->sqes, uring->sqes_len);
+  }
+  if (uring->cq_ptr != MAP_FAILED && uring->cq_ptr != uring->sq_ptr) {
+    munmap(uring->cq_ptr, uring->cq_len);
+  }
+  if (uring->sq_ptr != MAP_FAILED) {
+    munmap(uring->sq_ptr, uring->sq_len);
+  }
+  close(uring->ring_fd);
+  free(uring);
+}  /* lgr_uring_delete */
+
+
+#else  /* No io_uring. */
+
+int lgr_uring_create(lgr_uring_t **rtn_uring, unsigned int entries)
+{
+  return -1;
+}  /* lgr_uring_create */
+
+int lgr_uring_write(lgr_uring_t *uring, int fd, const void *buf,
+    unsigned int len, uint64_t offset, uint64_t user_data)
+{
+  errno = ENOSYS;
+  return -1;
+}  /* lgr_uring_write */
+
+int lgr_uring_reap(lgr_uring_t *uring, int wait, int *rtn_res,
+    uint64_t *rtn_user_data)
+{
+  errno = ENOSYS;
+  return -1;
+}  /* lgr_uring_reap */
+
+void lgr_uring_delete(lgr_uring_t *uring)
+{
+}  /* lgr_uring_delete */
+
+#endif
@@ -0,0 +1,50 @@
+/* lgr_uring.h - minimal io_uring file writer for lgr. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/lgr
+ */
+
+#ifndef LGR_URING_H
+#define LGR_URING_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lgr_uring_s;
+typedef struct lgr_uring_s lgr_uring_t;
+
+int lgr_uring_create(lgr_uring_t **rtn_uring, unsigned int entries);
+/* Set up an io_uring with room for "entries" requests, using raw system
+ * calls (no liburing). Returns 0 on success, or -1 if io_uring is not
+ * available (old kernel, non-Linux, disabled by policy). */
+
+int lgr_uring_write(lgr_uring_t *uring, int fd, const void *buf,
+    unsigned int len, uint64_t offset, uint64_t user_data);
+/* Submit a write of "buf" to "fd" at "offset". The buffer must not be
+ * modified until its completion is reaped. Returns 0 on success, -1 with
+ * errno set on failure (including no free submission entries). */
+
+int lgr_uring_reap(lgr_uring_t *uring, int wait, int *rtn_res,
+    uint64_t *rtn_user_data);
+/* Get one completion. If "wait" is 0, returns 0 if none is ready. Returns 1
+ * if a completion was reaped ("rtn_res" is the write()-style result), or
+ * -1 with errno set on failure. */
+
+void lgr_uring_delete(lgr_uring_t *uring);
+/* Tear down. Caller should reap all completions first. */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LGR_URING_H */
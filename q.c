@@ -21,7 +21,7 @@
  */
 
 #include <stdlib.h>
-#include <pthread.h>
+#include <stdatomic.h>
 
 /* If built with "-DSELFTEST" then include extras for unit testing. */
 #ifdef SELFTEST
@@ -47,23 +47,35 @@ static char *qerrs[] = {
 #define BAD_QERR (sizeof(qerrs)/sizeof(qerrs[0]) - 2)
 
 
-/* message element */
-struct q_msg_s {
-	void *d;
-	int in_use;
-};
-typedef struct q_msg_s q_msg_t;
+/* The queue is a single-producer, single-consumer ring of message pointers.
+ * (Multiple producers or consumers must serialize with a lock.)
+ * The producer owns enq_cnt and the consumer owns deq_cnt. Each side
+ * publishes its counter with a release store and reads the other side's
+ * with an acquire load, so the message pointer in the slot is always
+ * visible before the counter that covers it, even on weakly-ordered CPUs.
+ *
+ * Each side also keeps a private copy of the other side's counter, on its
+ * own cache line, and only re-reads the shared counter when the copy says
+ * the queue is full (producer) or empty (consumer). So in steady state,
+ * each side only touches the other's cache line once per "lap" instead of
+ * once per message. The slots themselves are just pointers; there is no
+ * per-slot flag shared between the two sides. */
 
 /* q.h contains an empty forward definition of "q_s", and defines "q_t" */
 struct q_s {
-	unsigned int enq_cnt;     /* count of successful messages enqueued (tail pointer) */
-	char enq_pad[CACHE_LINE_SIZE - (sizeof(unsigned int))];  /* align next var on cache line */
-
-	unsigned int deq_cnt;     /* count of successful messages dequeued (head pointer) */
-	char deq_pad[CACHE_LINE_SIZE - (sizeof(unsigned int))];  /* align next var on cache line */
-
-	q_msg_t * volatile msgs;  /* Array of "q_size" elements */
-	unsigned int size_mask;  /* Number of msgs elements minus 1 */
+	/* Producer side. */
+	atomic_uint enq_cnt;          /* count of successful messages enqueued (tail pointer) */
+	unsigned int enq_deq_cache;   /* producer's copy of deq_cnt */
+	char enq_pad[CACHE_LINE_SIZE - (2 * sizeof(unsigned int))];  /* align next var on cache line */
+
+	/* Consumer side. */
+	atomic_uint deq_cnt;          /* count of successful messages dequeued (head pointer) */
+	unsigned int deq_enq_cache;   /* consumer's copy of enq_cnt */
+	char deq_pad[CACHE_LINE_SIZE - (2 * sizeof(unsigned int))];  /* align next var on cache line */
+
+	/* Read-only after create. */
+	void **msgs;              /* Array of "q_size" elements (plus fence) */
+	unsigned int size_mask;   /* Number of msgs elements minus 1 */
 	/* make total size a multiple of cache line size, to prevent interference with whatever comes after */
 	char final_pad[CACHE_LINE_SIZE - ( sizeof(unsigned int) + sizeof(void **) )];
 };  /* struct q_s */
@@ -106,16 +118,12 @@ qerr_t q_create(q_t **rtn_q, unsigned int q_size)
 	perr = posix_memalign((void **)&q->msgs, CACHE_LINE_SIZE, (q_size + 1) * sizeof(q->msgs[0]) );
 	if (perr != 0 || q->msgs == NULL) { free(q);  return QERR_MALLOCERR; }
 
-	q->msgs[q_size].d = (void *)Q_FENCE;  /* used by unit tests to insure no overflow */
+	q->msgs[q_size] = (void *)Q_FENCE;  /* used by unit tests to insure no overflow */
 
-	/* empty the queue */
-	unsigned int i;
-	for (i = 0; i < q_size; i++) {
-		q->msgs[i].in_use = 0;
-	}
-
-	q->enq_cnt = 0;  /* Init the queue counters */
-	q->deq_cnt = 0;
+	atomic_init(&q->enq_cnt, 0);  /* Init the queue counters */
+	atomic_init(&q->deq_cnt, 0);
+	q->enq_deq_cache = 0;
+	q->deq_enq_cache = 0;
 
 	q->size_mask = q_size - 1;  /* bit mask to "and" enq_cnt and deq_cnt to get tail and head */
 
@@ -129,10 +137,10 @@ qerr_t q_create(q_t **rtn_q, unsigned int q_size)
 qerr_t q_delete(q_t *q)
 {
 	/* Quick sanity check to make sure the queue didn't overflow */
-	if (q->msgs[q->size_mask + 1].d != (void *)Q_FENCE) { return QERR_BUG1; }
-	q->msgs[q->size_mask + 1].d = NULL;  /* remove fence to maybe detect double-delete */
+	if (q->msgs[q->size_mask + 1] != (void *)Q_FENCE) { return QERR_BUG1; }
+	q->msgs[q->size_mask + 1] = NULL;  /* remove fence to maybe detect double-delete */
 
-	free((void *)q->msgs);
+	free(q->msgs);
 	free(q);
 
 	return QERR_OK;
@@ -142,16 +150,16 @@ qerr_t q_delete(q_t *q)
 /* See q.h for doc */
 qerr_t q_enq(q_t *q, void *m)
 {
-	unsigned int tail = (unsigned)(q->enq_cnt & q->size_mask);
+	unsigned int enq_cnt = atomic_load_explicit(&q->enq_cnt, memory_order_relaxed);
 
-	/* Queue must always have at least one empty slot.  Make sure that
-	 * after the current tail is filled, the next slot will be empty. */
-	unsigned int next_tail = (tail + 1) & q->size_mask;
-	if (q->msgs[next_tail].in_use) { return QERR_FULL; }  /* Queue is full, item not added */
+	/* Queue holds at most q_size - 1 messages. */
+	if (enq_cnt - q->enq_deq_cache >= q->size_mask) {
+		q->enq_deq_cache = atomic_load_explicit(&q->deq_cnt, memory_order_acquire);
+		if (enq_cnt - q->enq_deq_cache >= q->size_mask) { return QERR_FULL; }  /* Queue is full, item not added */
+	}
 
-	q->msgs[tail].d = (void * volatile)m;
-	q->msgs[tail].in_use = 1;
-	q->enq_cnt++;
+	q->msgs[enq_cnt & q->size_mask] = m;
+	atomic_store_explicit(&q->enq_cnt, enq_cnt + 1, memory_order_release);
 	return QERR_OK;
 }  /* q_enq */
 
@@ -159,33 +167,89 @@ qerr_t q_enq(q_t *q, void *m)
 /* See q.h for doc */
 qerr_t q_deq(q_t *q, void **rtn_m)
 {
-	unsigned int head = (unsigned)(q->deq_cnt & q->size_mask);
-	if (! q->msgs[head].in_use) { return QERR_EMPTY; }
+	unsigned int deq_cnt = atomic_load_explicit(&q->deq_cnt, memory_order_relaxed);
+
+	if (deq_cnt == q->deq_enq_cache) {
+		q->deq_enq_cache = atomic_load_explicit(&q->enq_cnt, memory_order_acquire);
+		if (deq_cnt == q->deq_enq_cache) { return QERR_EMPTY; }
+	}
 
-	*rtn_m = (void *)q->msgs[head].d;
-	q->msgs[head].in_use = 0;  /* mark it as empty */
-	q->deq_cnt++;
+	*rtn_m = q->msgs[deq_cnt & q->size_mask];
+	atomic_store_explicit(&q->deq_cnt, deq_cnt + 1, memory_order_release);
 	return QERR_OK;
 }  /* q_deq */
 
 
+/* See q.h for doc */
+unsigned int q_enq_batch(q_t *q, void **msgs, unsigned int n)
+{
+	unsigned int enq_cnt = atomic_load_explicit(&q->enq_cnt, memory_order_relaxed);
+	unsigned int room = q->size_mask - (enq_cnt - q->enq_deq_cache);
+	unsigned int i;
+
+	if (room < n) {
+		q->enq_deq_cache = atomic_load_explicit(&q->deq_cnt, memory_order_acquire);
+		room = q->size_mask - (enq_cnt - q->enq_deq_cache);
+		if (room < n) { n = room; }
+	}
+
+	for (i = 0; i < n; i++) {
+		q->msgs[(enq_cnt + i) & q->size_mask] = msgs[i];
+	}
+	if (n > 0) {
+		atomic_store_explicit(&q->enq_cnt, enq_cnt + n, memory_order_release);
+	}
+	return n;
+}  /* q_enq_batch */
+
+
+/* See q.h for doc */
+unsigned int q_deq_batch(q_t *q, void **rtn_msgs, unsigned int n)
+{
+	unsigned int deq_cnt = atomic_load_explicit(&q->deq_cnt, memory_order_relaxed);
+	unsigned int avail = q->deq_enq_cache - deq_cnt;
+	unsigned int i;
+
+	if (avail < n) {
+		q->deq_enq_cache = atomic_load_explicit(&q->enq_cnt, memory_order_acquire);
+		avail = q->deq_enq_cache - deq_cnt;
+		if (avail < n) { n = avail; }
+	}
+
+	for (i = 0; i < n; i++) {
+		rtn_msgs[i] = q->msgs[(deq_cnt + i) & q->size_mask];
+	}
+	if (n > 0) {
+		atomic_store_explicit(&q->deq_cnt, deq_cnt + n, memory_order_release);
+	}
+	return n;
+}  /* q_deq_batch */
+
+
 /* See q.h for doc */
 int q_is_empty(q_t *q)
 {
-	unsigned int head = (unsigned)(q->deq_cnt & q->size_mask);
-	return (! q->msgs[head].in_use);
+	unsigned int deq_cnt = atomic_load_explicit(&q->deq_cnt, memory_order_acquire);
+	return (atomic_load_explicit(&q->enq_cnt, memory_order_acquire) == deq_cnt);
 }  /* q_is_empty */
 
 
 /* See q.h for doc */
 int q_is_full(q_t *q)
 {
-	unsigned int tail = (unsigned)(q->enq_cnt & q->size_mask);
-	unsigned int next_tail = (tail + 1) & q->size_mask;
-	return (q->msgs[next_tail].in_use);
+	unsigned int enq_cnt = atomic_load_explicit(&q->enq_cnt, memory_order_acquire);
+	return (enq_cnt - atomic_load_explicit(&q->deq_cnt, memory_order_acquire) >= q->size_mask);
 }  /* q_is_full */
 
 
+/* See q.h for doc */
+unsigned int q_count(q_t *q)
+{
+	unsigned int deq_cnt = atomic_load_explicit(&q->deq_cnt, memory_order_acquire);
+	return atomic_load_explicit(&q->enq_cnt, memory_order_acquire) - deq_cnt;
+}  /* q_count */
+
+
 /* If built with "-DSELFTEST" then include main() for unit testing. */
 #ifdef SELFTEST
 #include "q_selftest.c"
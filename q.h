@@ -58,6 +58,22 @@ qerr_t q_deq(q_t *q, void **rtn_m);
  * rtn_m : Pointer to caller's message handle.
  * Returns QERR_OK on success, QERR_EMPTY if queue empty, or other QERR_* value on error. */
 
+unsigned int q_enq_batch(q_t *q, void **msgs, unsigned int n);
+/* Add up to "n" messages to the queue, with a single update of the
+ * enqueue count.
+ * q    : Queue instance handle.
+ * msgs : Array of messages to enqueue, in order.
+ * n    : Number of messages in "msgs".
+ * Returns number of messages enqueued (less than "n" if the queue filled). */
+
+unsigned int q_deq_batch(q_t *q, void **rtn_msgs, unsigned int n);
+/* Remove up to "n" messages from the queue, with a single update of the
+ * dequeue count.
+ * q        : Queue instance handle.
+ * rtn_msgs : Caller's array of at least "n" message handles.
+ * n        : Maximum number of messages to dequeue.
+ * Returns number of messages dequeued (0 if queue empty). */
+
 int q_is_empty(q_t *q);
 /* Returns 1 if queue is empty (contains no messages), 0 otherwise.
  * q : Queue instance handle. */
@@ -66,6 +82,11 @@ int q_is_full(q_t *q);
 /* Returns 1 if queue is full (contains q_size-1 message), 0 otherwise.
  * q : Queue instance handle. */
 
+unsigned int q_count(q_t *q);
+/* Returns the number of messages in the queue.  If other threads are
+ * enqueuing or dequeuing, the result is only a snapshot.
+ * q : Queue instance handle. */
+
 char *q_qerr_str(qerr_t qerr);
 /* Returns a string representation of a queue API return error code.
  * qerr : value returned by most q APIs indicating success or faiure.
@@ -0,0 +1,348 @@
+/* q_bench.c - latency and throughput benchmark for q.c. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/lgr
+ */
+
+/* Usage: q_bench [-h] [-c cpu_a,cpu_b] [-p round_trips] [-n msgs]
+ *                [-q q_sizes] [-b batch_sizes]
+ * Two tests, each between two threads pinned to different CPUs:
+ *   pingpong - thread A enqueues to B, B echoes it back on a second queue;
+ *              every round trip is timed.
+ *   stream - thread A enqueues "msgs" messages as fast as it can while B
+ *            dequeues them, for every q_size and batch size combination
+ *            (batch > 1 uses q_enq_batch()/q_deq_batch()).
+ * Results are CSV on stdout (see usage()). */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#if ! defined(_WIN32)
+  #include <stdlib.h>
+  #include <time.h>
+  #include <unistd.h>
+  #include <sys/time.h>
+#endif
+
+#include "cprt.h"
+#include "q.h"
+
+
+#define MAX_LIST 16
+#define MAX_BATCH 256
+
+/* Spin this many times on an empty/full queue before yielding the CPU, so
+ * the test still finishes if both threads end up on one CPU. */
+#define SPIN_YIELD 1000
+
+/* Options. */
+static int o_cpu_a = -1;  /* -1 = don't pin. */
+static int o_cpu_b = -1;
+static int o_round_trips = 100000;
+static int o_msgs = 10000000;
+
+/* Shared with thread B. */
+static q_t *q_ab;
+static q_t *q_ba;
+static int cur_batch;
+static uint64_t stream_msgs;
+static struct cprt_timespec stream_end_ts;
+
+
+static void usage(char *msg)
+{
+  if (msg) fprintf(stderr, "\n%s\n\n", msg);
+  fprintf(stderr, "Usage: q_bench [-h] [-c cpu_a,cpu_b] [-p round_trips] "
+      "[-n msgs] [-q q_sizes] [-b batch_sizes]\n"
+      "where:\n"
+      "  -h : help.\n"
+      "  -c cpu_a,cpu_b : CPUs for the two threads (default 0,1 if there\n"
+      "                   are at least 2 CPUs, else not pinned).\n"
+      "  -p round_trips : pingpong round trips (default 100000).\n"
+      "  -n msgs : stream messages per combination (default 10000000).\n"
+      "  -q q_sizes : stream q_size values (default 64,1024,16384).\n"
+      "  -b batch_sizes : stream batch sizes, max %d (default 1,32).\n"
+      "Output is CSV, one line per test:\n"
+      "  test,q_size,batch,msgs,mean_ns,p50_ns,p99_ns,p999_ns,max_ns,"
+      "msgs_per_sec\n"
+      "pingpong latencies are round trips; stream has no percentiles.\n",
+      MAX_BATCH);
+  exit(1);
+}  /* usage */
+
+
+/* Parse comma-separated positive integers. Returns number of values. */
+static int parse_list(char *str, int *vals)
+{
+  char *copy = strdup(str);
+  char *tok, *save;
+  int n = 0;
+
+  CPRT_ENULL(copy);
+  for (tok = strtok_r(copy, ",", &save); tok != NULL;
+      tok = strtok_r(NULL, ",", &save)) {
+    if (n == MAX_LIST) usage("Too many values in list");
+    CPRT_ATOI(tok, vals[n]);
+    if (vals[n] <= 0) usage("Values must be > 0");
+    n++;
+  }
+  free(copy);
+  return n;
+}  /* parse_list */
+
+
+static void pin(int cpu)
+{
+  if (cpu >= 0) {
+    cprt_set_affinity((uint64_t)1 << cpu);
+  }
+}  /* pin */
+
+
+static void spin(unsigned int *spins)
+{
+  if (++(*spins) >= SPIN_YIELD) {
+    *spins = 0;
+    CPRT_YIELD();
+  }
+  else {
+    CPRT_CPU_PAUSE();
+  }
+}  /* spin */
+
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t va = *(const uint64_t *)a;
+  uint64_t vb = *(const uint64_t *)b;
+  return (va < vb) ? -1 : (va > vb);
+}  /* cmp_u64 */
+
+
+static uint64_t pct(uint64_t *sorted, int n, double p)
+{
+  int i = (int)((double)n * p / 100.0);
+  if (i >= n) i = n - 1;
+  return sorted[i];
+}  /* pct */
+
+
+/* Thread B of pingpong: echo every message back. A NULL message ends it. */
+CPRT_THREAD_ENTRYPOINT echo_thread(void *in_arg)
+{
+  unsigned int spins = 0;
+  void *m;
+
+  pin(o_cpu_b);
+  for (;;) {
+    while (q_deq(q_ab, &m) != QERR_OK) {
+      spin(&spins);
+    }
+    if (m == NULL) {
+      break;
+    }
+    while (q_enq(q_ba, m) != QERR_OK) {
+      spin(&spins);
+    }
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* echo_thread */
+
+
+static void pingpong(int q_size)
+{
+  CPRT_THREAD_T thread_id;
+  struct cprt_timespec start_ts, t0, t1;
+  uint64_t *rtt_ns;
+  uint64_t sum_ns, total_ns;
+  unsigned int spins = 0;
+  void *m;
+  int i;
+
+  CPRT_EOK0(q_create(&q_ab, q_size));
+  CPRT_EOK0(q_create(&q_ba, q_size));
+  rtt_ns = (uint64_t *)malloc(o_round_trips * sizeof(uint64_t));
+  CPRT_ENULL(rtt_ns);
+
+  CPRT_THREAD_CREATE(thread_id, echo_thread, NULL);
+
+  /* Warm up caches and the other thread. */
+  for (i = 0; i < 1000; i++) {
+    while (q_enq(q_ab, (void *)(uintptr_t)(i + 1)) != QERR_OK) spin(&spins);
+    while (q_deq(q_ba, &m) != QERR_OK) spin(&spins);
+  }
+
+  sum_ns = 0;
+  CPRT_GETTIME(&start_ts);
+  for (i = 0; i < o_round_trips; i++) {
+    CPRT_GETTIME(&t0);
+    while (q_enq(q_ab, (void *)(uintptr_t)(i + 1)) != QERR_OK) spin(&spins);
+    while (q_deq(q_ba, &m) != QERR_OK) spin(&spins);
+    CPRT_GETTIME(&t1);
+    CPRT_ASSERT(m == (void *)(uintptr_t)(i + 1));
+    CPRT_DIFF_TS(rtt_ns[i], t1, t0);
+    sum_ns += rtt_ns[i];
+  }
+  CPRT_DIFF_TS(total_ns, t1, start_ts);
+
+  while (q_enq(q_ab, NULL) != QERR_OK) spin(&spins);
+  CPRT_THREAD_JOIN(thread_id);
+
+  qsort(rtt_ns, o_round_trips, sizeof(uint64_t), cmp_u64);
+  printf("pingpong,%d,1,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+      ",%" PRIu64 ",%.0f\n",
+      q_size, o_round_trips, sum_ns / o_round_trips,
+      pct(rtt_ns, o_round_trips, 50), pct(rtt_ns, o_round_trips, 99),
+      pct(rtt_ns, o_round_trips, 99.9), rtt_ns[o_round_trips - 1],
+      (double)o_round_trips * 1e9 / (double)total_ns);
+  fflush(stdout);
+
+  free(rtt_ns);
+  CPRT_EOK0(q_delete(q_ab));
+  CPRT_EOK0(q_delete(q_ba));
+}  /* pingpong */
+
+
+/* Thread B of stream: dequeue (and check) every message. */
+CPRT_THREAD_ENTRYPOINT drain_thread(void *in_arg)
+{
+  void *msgs[MAX_BATCH];
+  unsigned int spins = 0;
+  uint64_t expect = 1;
+
+  pin(o_cpu_b);
+  while (expect <= stream_msgs) {
+    unsigned int n, i;
+
+    if (cur_batch > 1) {
+      n = q_deq_batch(q_ab, msgs, cur_batch);
+    }
+    else {
+      n = (q_deq(q_ab, &msgs[0]) == QERR_OK);
+    }
+    if (n == 0) {
+      spin(&spins);
+      continue;
+    }
+    for (i = 0; i < n; i++) {
+      CPRT_ASSERT(msgs[i] == (void *)(uintptr_t)expect);
+      expect++;
+    }
+  }
+  CPRT_GETTIME(&stream_end_ts);
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* drain_thread */
+
+
+static void stream(int q_size, int batch)
+{
+  CPRT_THREAD_T thread_id;
+  struct cprt_timespec start_ts;
+  void *msgs[MAX_BATCH];
+  unsigned int spins = 0;
+  uint64_t next, total_ns;
+
+  CPRT_EOK0(q_create(&q_ab, q_size));
+  cur_batch = batch;
+  stream_msgs = o_msgs;
+
+  CPRT_THREAD_CREATE(thread_id, drain_thread, NULL);
+  CPRT_SLEEP_MS(10);  /* Let thread B start spinning. */
+
+  CPRT_GETTIME(&start_ts);
+  next = 1;
+  while (next <= stream_msgs) {
+    if (batch > 1) {
+      unsigned int n, i;
+
+      n = (stream_msgs - next + 1 < (uint64_t)batch)
+          ? (unsigned int)(stream_msgs - next + 1) : (unsigned int)batch;
+      for (i = 0; i < n; i++) {
+        msgs[i] = (void *)(uintptr_t)(next + i);
+      }
+      n = q_enq_batch(q_ab, msgs, n);
+      if (n == 0) {
+        spin(&spins);
+      }
+      next += n;
+    }
+    else if (q_enq(q_ab, (void *)(uintptr_t)next) == QERR_OK) {
+      next++;
+    }
+    else {
+      spin(&spins);
+    }
+  }
+  CPRT_THREAD_JOIN(thread_id);
+  CPRT_DIFF_TS(total_ns, stream_end_ts, start_ts);
+
+  printf("stream,%d,%d,%d,%.2f,,,,,%.0f\n", q_size, batch, o_msgs,
+      (double)total_ns / (double)o_msgs,
+      (double)o_msgs * 1e9 / (double)total_ns);
+  fflush(stdout);
+
+  CPRT_EOK0(q_delete(q_ab));
+}  /* stream */
+
+
+int main(int argc, char **argv)
+{
+  int q_sizes[MAX_LIST], batches[MAX_LIST], cpus[MAX_LIST];
+  int num_q_sizes, num_batches, num_cpus;
+  int opt;
+  int q, b;
+
+#if ! defined(_WIN32)
+  if (sysconf(_SC_NPROCESSORS_ONLN) >= 2) {
+    o_cpu_a = 0;
+    o_cpu_b = 1;
+  }
+#endif
+  num_q_sizes = parse_list("64,1024,16384", q_sizes);
+  num_batches = parse_list("1,32", batches);
+
+  while ((opt = cprt_getopt(argc, argv, "hc:p:n:q:b:")) != EOF) {
+    switch (opt) {
+      case 'h': usage(NULL); break;
+      case 'c':
+        num_cpus = parse_list(cprt_optarg, cpus);
+        if (num_cpus != 2) usage("-c needs two CPUs");
+        o_cpu_a = cpus[0];
+        o_cpu_b = cpus[1];
+        break;
+      case 'p': CPRT_ATOI(cprt_optarg, o_round_trips); break;
+      case 'n': CPRT_ATOI(cprt_optarg, o_msgs); break;
+      case 'q': num_q_sizes = parse_list(cprt_optarg, q_sizes); break;
+      case 'b': num_batches = parse_list(cprt_optarg, batches); break;
+      default: usage(NULL);
+    }
+  }
+  if (o_round_trips <= 0 || o_msgs <= 0) usage("Counts must be > 0");
+  if (cprt_optind != argc) usage("Unexpected positional parameter");
+  for (b = 0; b < num_batches; b++) {
+    if (batches[b] > MAX_BATCH) usage("Batch size too large");
+  }
+
+  pin(o_cpu_a);
+
+  printf("test,q_size,batch,msgs,mean_ns,p50_ns,p99_ns,p999_ns,max_ns,"
+      "msgs_per_sec\n");
+  pingpong(64);
+  for (q = 0; q < num_q_sizes; q++) {
+    for (b = 0; b < num_batches; b++) {
+      stream(q_sizes[q], batches[b]);
+    }
+  }
+
+  return 0;
+}  /* main */
@@ -0,0 +1,196 @@
+/* qm.c - lock-free, non-blocking, multi-producer, multi-consumer queue. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ * 
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can 
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/q
+ */
+
+/* The algorithm is Dmitry Vyukov's bounded MPMC queue:
+ *     http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ * Each slot has a sequence number that says whose turn it is. A producer
+ * claims the slot at enq_pos with one CAS when the slot's sequence equals
+ * enq_pos, fills it, then publishes it by setting the sequence to
+ * enq_pos + 1. A consumer claims the slot at deq_pos when its sequence
+ * equals deq_pos + 1, takes the message, then hands the slot to the next
+ * lap's producer by setting the sequence to deq_pos + q_size.
+ * So contention between producers (or between consumers) costs a failed
+ * CAS and retry, never a lock, and producers and consumers only meet at
+ * a slot when the queue is nearly empty or full.
+ *
+ * See qm.h file for details on the API functions.
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "qm.h"
+
+#define QM_FENCE 0x7d831f21   /* used for testing (overflow detection) */
+
+/* message element */
+struct qm_cell_s {
+	atomic_uint seq;  /* See algorithm description above. */
+	void *d;
+};
+typedef struct qm_cell_s qm_cell_t;
+
+/* qm.h contains an empty forward definition of "qm_s", and defines "qm_t" */
+struct qm_s {
+	atomic_uint enq_pos;      /* next slot to enqueue into (shared by producers) */
+	char enq_pad[CACHE_LINE_SIZE - (sizeof(unsigned int))];  /* align next var on cache line */
+
+	atomic_uint deq_pos;      /* next slot to dequeue from (shared by consumers) */
+	char deq_pad[CACHE_LINE_SIZE - (sizeof(unsigned int))];  /* align next var on cache line */
+
+	/* Read-only after create. */
+	qm_cell_t *cells;         /* Array of "q_size" elements (plus fence) */
+	unsigned int size_mask;   /* Number of cells minus 1 */
+	/* make total size a multiple of cache line size, to prevent interference with whatever comes after */
+	char final_pad[CACHE_LINE_SIZE - ( sizeof(unsigned int) + sizeof(void **) )];
+};  /* struct qm_s */
+
+
+/* Internal function: return 1 if power of 2 */
+static int is_power_2(unsigned int n)
+{
+	return ((n-1) & n) == 0;
+}  /* is_power_2 */
+
+
+/* See qm.h for doc */
+qerr_t qm_create(qm_t **rtn_q, unsigned int q_size)
+{
+	if (sizeof(qm_t) % CACHE_LINE_SIZE != 0) { return QERR_BUG2; }  /* qm_t not multiple of cache line size */
+
+	/* Sanity check input size */
+	if (q_size <= 1 || ! is_power_2(q_size)) { return QERR_BADSIZE; }
+
+	/* Create queue object instance */
+	qm_t *q = NULL;
+	int perr = posix_memalign((void **)&q, CACHE_LINE_SIZE, sizeof(*q));
+	if (perr != 0 || q == NULL) { return QERR_MALLOCERR; }
+
+	/* Allocate message storage array (one extra unused element for fence) */
+	q->cells = NULL;
+	perr = posix_memalign((void **)&q->cells, CACHE_LINE_SIZE, (q_size + 1) * sizeof(q->cells[0]) );
+	if (perr != 0 || q->cells == NULL) { free(q);  return QERR_MALLOCERR; }
+
+	q->cells[q_size].d = (void *)QM_FENCE;  /* used by unit tests to insure no overflow */
+
+	/* empty the queue: each slot is ready for the first lap's producer */
+	unsigned int i;
+	for (i = 0; i < q_size; i++) {
+		atomic_init(&q->cells[i].seq, i);
+		q->cells[i].d = NULL;
+	}
+
+	atomic_init(&q->enq_pos, 0);
+	atomic_init(&q->deq_pos, 0);
+
+	q->size_mask = q_size - 1;
+
+	/* Success */
+	*rtn_q = q;
+	return QERR_OK;
+}  /* qm_create */
+
+
+/* See qm.h for doc */
+qerr_t qm_delete(qm_t *q)
+{
+	/* Quick sanity check to make sure the queue didn't overflow */
+	if (q->cells[q->size_mask + 1].d != (void *)QM_FENCE) { return QERR_BUG1; }
+	q->cells[q->size_mask + 1].d = NULL;  /* remove fence to maybe detect double-delete */
+
+	free(q->cells);
+	free(q);
+
+	return QERR_OK;
+}  /* qm_delete */
+
+
+/* See qm.h for doc */
+qerr_t qm_enq(qm_t *q, void *m)
+{
+	qm_cell_t *cell;
+	unsigned int pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
+
+	for (;;) {
+		cell = &q->cells[pos & q->size_mask];
+		unsigned int seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		int dif = (int)(seq - pos);
+		if (dif == 0) {
+			/* Slot is free; try to claim it (updates pos on failure). */
+			if (atomic_compare_exchange_weak_explicit(&q->enq_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (dif < 0) {
+			return QERR_FULL;  /* Slot still holds last lap's message. */
+		}
+		else {
+			/* Another producer claimed it; catch up. */
+			pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
+		}
+	}
+
+	cell->d = m;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+	return QERR_OK;
+}  /* qm_enq */
+
+
+/* See qm.h for doc */
+qerr_t qm_deq(qm_t *q, void **rtn_m)
+{
+	qm_cell_t *cell;
+	unsigned int pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+
+	for (;;) {
+		cell = &q->cells[pos & q->size_mask];
+		unsigned int seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		int dif = (int)(seq - (pos + 1));
+		if (dif == 0) {
+			/* Slot is published; try to claim it (updates pos on failure). */
+			if (atomic_compare_exchange_weak_explicit(&q->deq_pos, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (dif < 0) {
+			return QERR_EMPTY;  /* Slot not yet published. */
+		}
+		else {
+			/* Another consumer claimed it; catch up. */
+			pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+		}
+	}
+
+	*rtn_m = cell->d;
+	/* Hand the slot to the next lap's producer. */
+	atomic_store_explicit(&cell->seq, pos + q->size_mask + 1, memory_order_release);
+	return QERR_OK;
+}  /* qm_deq */
+
+
+/* See qm.h for doc */
+int qm_is_empty(qm_t *q)
+{
+	unsigned int pos = atomic_load_explicit(&q->deq_pos, memory_order_acquire);
+	qm_cell_t *cell = &q->cells[pos & q->size_mask];
+	return ((int)(atomic_load_explicit(&cell->seq, memory_order_acquire) - (pos + 1)) < 0);
+}  /* qm_is_empty */
+
+
+/* See qm.h for doc */
+unsigned int qm_count(qm_t *q)
+{
+	unsigned int deq_pos = atomic_load_explicit(&q->deq_pos, memory_order_acquire);
+	return atomic_load_explicit(&q->enq_pos, memory_order_acquire) - deq_pos;
+}  /* qm_count */
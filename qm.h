@@ -0,0 +1,65 @@
+/* qm.h - lock-free, non-blocking, multi-producer, multi-consumer queue. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ * 
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can 
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/q
+ */
+
+#ifndef QM_H
+#define QM_H
+
+#include "q.h"  /* For qerr_t and QERR_* definitions. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct qm_s;                      /* forward (opaque) definition */
+typedef struct qm_s qm_t;         /* object type of queue instance */
+
+qerr_t qm_create(qm_t **rtn_q, unsigned int q_size);
+/* Create an instance of a multi-producer, multi-consumer queue.
+ * rtn_q  : Pointer to caller's queue instance handle.
+ * q_size : Number of queue elements to allocate.  Must be > 1 and a power
+ *          of 2.  All q_size elements can be stored in the queue.
+ * Returns QERR_OK on success, or other QERR_* value on error. */
+
+qerr_t qm_delete(qm_t *q);
+/* Delete an instance of a queue.
+ * q : Queue instance handle.
+ * Returns QERR_OK on success, or other QERR_* value on error. */
+
+qerr_t qm_enq(qm_t *q, void *m);
+/* Add a message to the queue.  Any number of threads may call this
+ * at the same time.
+ * q : Queue instance handle.
+ * m : Message to enqueue.
+ * Returns QERR_OK on success, QERR_FULL if queue full, or other QERR_* value on error. */
+
+qerr_t qm_deq(qm_t *q, void **rtn_m);
+/* Remove a message from the queue.  Any number of threads may call this
+ * at the same time.
+ * q     : Queue instance handle.
+ * rtn_m : Pointer to caller's message handle.
+ * Returns QERR_OK on success, QERR_EMPTY if queue empty, or other QERR_* value on error. */
+
+int qm_is_empty(qm_t *q);
+/* Returns 1 if no message is ready to be dequeued, 0 otherwise.
+ * q : Queue instance handle. */
+
+unsigned int qm_count(qm_t *q);
+/* Returns the number of messages in the queue (including ones that are
+ * still being enqueued).  If other threads are enqueuing or dequeuing,
+ * the result is only a snapshot.
+ * q : Queue instance handle. */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* QM_H */
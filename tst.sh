@@ -1,51 +1,18 @@
 #!/bin/sh
 
 # Remove old log files.
-rm -f x._???
+rm -f x._??? y._???
 
 ./lgr_test
 
-echo "Testing perf."
+echo "Testing bench."
 
-# Skip "Opening", "Starting", and first log (to warm up cache).
-FILE=`./lgr_perf`
-START=`sed -n "4s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-END=`sed -n "4003s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-# Prepend a '1' so Perl doesn't interpret leading zero as octal.
-perl -e "print '($END - $START) / 4000 = ' . (1$END - 1$START) / 4000 . \"\n\";"
+# Short sweep; see "lgr_bench -h" for a full one.
+./lgr_bench -n 4000 -t 1,2 -m 32 -q 4096
+if [ $? -ne 0 ]; then echo "ERROR: lgr_bench failed"; exit 1; fi
 
-FILE=`./lgr_perf`
-START=`sed -n "4s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-END=`sed -n "4003s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-# Prepend a '1' so Perl doesn't interpret leading zero as octal.
-perl -e "print '($END - $START) / 4000 = ' . (1$END - 1$START) / 4000 . \"\n\";"
+echo "Testing q bench."
 
-FILE=`./lgr_perf`
-START=`sed -n "4s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-END=`sed -n "4003s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-# Prepend a '1' so Perl doesn't interpret leading zero as octal.
-perl -e "print '($END - $START) / 4000 = ' . (1$END - 1$START) / 4000 . \"\n\";"
-
-FILE=`./lgr_perf`
-START=`sed -n "4s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-END=`sed -n "4003s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-# Prepend a '1' so Perl doesn't interpret leading zero as octal.
-perl -e "print '($END - $START) / 4000 = ' . (1$END - 1$START) / 4000 . \"\n\";"
-
-FILE=`./lgr_perf`
-START=`sed -n "4s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-END=`sed -n "4003s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-# Prepend a '1' so Perl doesn't interpret leading zero as octal.
-perl -e "print '($END - $START) / 4000 = ' . (1$END - 1$START) / 4000 . \"\n\";"
-
-FILE=`./lgr_perf`
-START=`sed -n "4s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-END=`sed -n "4003s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-# Prepend a '1' so Perl doesn't interpret leading zero as octal.
-perl -e "print '($END - $START) / 4000 = ' . (1$END - 1$START) / 4000 . \"\n\";"
-
-FILE=`./lgr_perf`
-START=`sed -n "4s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-END=`sed -n "4003s/^.......... ..:..:..\.\(......\).*$/\1/p" $FILE`
-# Prepend a '1' so Perl doesn't interpret leading zero as octal.
-perl -e "print '($END - $START) / 4000 = ' . (1$END - 1$START) / 4000 . \"\n\";"
+# Short run; see "q_bench -h" for a full one.
+./q_bench -p 2000 -n 200000 -q 1024 -b 1,32
+if [ $? -ne 0 ]; then echo "ERROR: q_bench failed"; exit 1; fi